@@ -0,0 +1,231 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "delta.h"
+#include "format.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "step.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+uint64_t updateFingerprint(const uint64_t &fingerprint, const uint64_t &hash)
+{
+	return fingerprint * 1099511628211ULL ^ hash;
+}
+
+bool indexDeltaBase(const std::string &inputFile, DeltaBase &base)
+{
+	StepFile file;
+	if (!file.open(inputFile))
+		return false;
+
+	Progress progress("index", inputFile, file.fileSize());
+	StepRecord record;
+	while (file.next(record))
+	{
+		base.fingerprint = updateFingerprint(base.fingerprint, canonicalHash(record.begin, record.end));
+		++base.records;
+		if (!progress.update(base.records, file.position()))
+			return false;
+	}
+
+	progress.finish();
+	return true;
+}
+
+bool hashDeltaBase(IfcParse::IfcFile &ifcfile, const std::string &inputFile, DeltaBase &base)
+{
+	base.hashes.clear();
+	std::string text;
+	Progress progress("hash", inputFile, 0, std::distance(ifcfile.begin(), ifcfile.end()));
+	for (auto it = ifcfile.begin(); it != ifcfile.end(); ++it)
+	{
+		if (!progress.add(1))
+			return false;
+
+		auto id = it->first;
+		text.clear();
+		formatEntity(text, it->second);
+		if (id >= base.hashes.size())
+			base.hashes.resize(std::max<size_t>(id + 1, base.hashes.size() * 2), 0);
+		base.hashes[id] = canonicalHash(text.data(), text.data() + text.size());
+	}
+
+	progress.finish();
+	return true;
+}
+
+bool writeDelta(const DeltaBase &base, IfcParse::IfcFile &ifcfile, const std::string &deltaFile)
+{
+	std::vector<bool> seen(base.hashes.size(), false);
+	std::string entries;
+	std::string text;
+	size_t added = 0, modified = 0, removed = 0;
+
+	Progress progress("delta", deltaFile, 0, std::distance(ifcfile.begin(), ifcfile.end()));
+	for (auto it = ifcfile.begin(); it != ifcfile.end(); ++it)
+	{
+		if (!progress.add(1))
+			return false;
+
+		auto id = it->first;
+		text.clear();
+		formatEntity(text, it->second);
+		if (id < base.hashes.size() && base.hashes[id])
+		{
+			seen[id] = true;
+			if (canonicalHash(text.data(), text.data() + text.size()) == base.hashes[id])
+				continue;
+			++modified;
+		}
+		else
+		{
+			++added;
+		}
+		entries += text;
+		entries += ";\n";
+	}
+
+	std::ofstream os(deltaFile, std::ios::binary);
+	os << "IFC-DELTA;\n";
+	os << "BASE(" << base.records << "," << base.fingerprint << ");\n";
+	for (size_t id = 0; id < base.hashes.size(); ++id)
+	{
+		if (base.hashes[id] && !seen[id])
+		{
+			os << "REMOVED(#" << id << ");\n";
+			++removed;
+		}
+	}
+	os << "DATA;\n" << entries << "ENDSEC;\nEND-IFC-DELTA;\n";
+	os.close();
+
+	if (!os)
+	{
+		std::cerr << "Failed to write " << deltaFile << std::endl;
+		return false;
+	}
+
+	progress.finish();
+	std::cout << deltaFile << ": " << added << " added, " << modified << " modified, " << removed << " removed" << std::endl;
+	return true;
+}
+
+bool applyDelta(const std::string &baseFile, const std::string &deltaFile, const std::string &outputFile)
+{
+	StepFile delta;
+	if (!delta.open(deltaFile))
+		return false;
+
+	auto header = delta.header();
+	size_t expectedRecords = 0;
+	unsigned long long expectedFingerprint = 0;
+	auto basePos = header.find("BASE(");
+	if (header.compare(0, 10, "IFC-DELTA;") || basePos == std::string::npos
+		|| std::sscanf(header.c_str() + basePos, "BASE(%zu,%llu)", &expectedRecords, &expectedFingerprint) != 2)
+	{
+		std::cerr << deltaFile << " is not a valid delta file" << std::endl;
+		return false;
+	}
+
+	std::unordered_set<unsigned> removed;
+	for (auto pos = header.find("REMOVED(#"); pos != std::string::npos; pos = header.find("REMOVED(#", pos + 1))
+		removed.insert(std::stoul(header.substr(pos + 9)));
+
+	//Delta records in the order they appear, those not found within the base are new entities
+	std::unordered_map<unsigned, StepRecord> changes;
+	std::vector<unsigned> order;
+	StepRecord record;
+	while (delta.next(record))
+	{
+		changes[record.id] = record;
+		order.push_back(record.id);
+	}
+
+	StepFile base;
+	if (!base.open(baseFile))
+		return false;
+
+	ShardWriter writer(outputFile);
+	writer.append(base.header() + "\n");
+
+	Progress progress("apply", outputFile, base.fileSize());
+	size_t records = 0;
+	uint64_t fingerprint = 0;
+	while (base.next(record))
+	{
+		fingerprint = updateFingerprint(fingerprint, canonicalHash(record.begin, record.end));
+		++records;
+		if (!progress.update(records, base.position()))
+		{
+			writer.finish();
+			std::remove(outputFile.c_str());
+			return false;
+		}
+
+		if (removed.count(record.id))
+			continue;
+
+		auto it = changes.find(record.id);
+		if (it != changes.end())
+		{
+			writer.append(it->second.begin, it->second.end - it->second.begin);
+			changes.erase(it);
+		}
+		else
+		{
+			writer.append(record.begin, record.end - record.begin);
+		}
+		writer.append("\n", 1);
+	}
+
+	for (const auto &id : order)
+	{
+		auto it = changes.find(id);
+		if (it != changes.end())
+		{
+			writer.append(it->second.begin, it->second.end - it->second.begin);
+			writer.append("\n", 1);
+		}
+	}
+
+	writer.append(base.trailer());
+	bool written = writer.finish();
+	progress.finish();
+
+	if (records != expectedRecords || fingerprint != expectedFingerprint)
+	{
+		std::cerr << deltaFile << " was not computed against " << baseFile << std::endl;
+		std::remove(outputFile.c_str());
+		return false;
+	}
+
+	if (!written)
+	{
+		std::cerr << "Failed to write " << outputFile << std::endl;
+		return false;
+	}
+
+	return true;
+}
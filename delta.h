@@ -0,0 +1,95 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* Delta output: rather than rewriting the whole model, only the entities that
+* were added, modified or removed with respect to the input file are written.
+*
+* A delta file reads as follows:
+*   IFC-DELTA;
+*   BASE(<number of records in the base file>,<fingerprint of the base file>);
+*   REMOVED(#<id>);   (one per removed entity)
+*   DATA;
+*   #<id>=<entity>;   (added or modified entities, as they appear in the full output)
+*   ENDSEC;
+*   END-IFC-DELTA;
+*/
+
+#pragma once
+
+#include <ifcparse/IfcParse.h>
+#include <ifcparse/IfcFile.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+* An index over the input file that deltas are computed against. The record count and
+* fingerprint identify the file as it is on disk. The hashes are taken from the model as
+* loaded, before it is modified: the exporter of the input file may well format entities
+* differently to IfcOpenShell, and only actual changes are to be written.
+*/
+struct DeltaBase
+{
+	std::vector<uint64_t> hashes;      //canonical hash of each entity of the model, indexed by id. 0 if the id is unused
+	size_t                records = 0; //number of records in the file
+	uint64_t              fingerprint = 0;
+};
+
+/**
+* Fold a record into the fingerprint of the file it belongs to
+* @param fingerprint fingerprint so far
+* @param hash canonical hash of the record
+* @return returns the updated fingerprint
+*/
+uint64_t updateFingerprint(const uint64_t &fingerprint, const uint64_t &hash);
+
+/**
+* Count and fingerprint the records of the input file, so deltas can be checked against it
+* @param inputFile input IFC file
+* @param base index to populate
+* @return returns true upon success
+*/
+bool indexDeltaBase(const std::string &inputFile, DeltaBase &base);
+
+/**
+* Hash the entities of the model as it was loaded, before anything is changed
+* @param ifcfile the model, as loaded from the base file
+* @param inputFile the file the model was loaded from, to report progress against
+* @param base index to populate
+* @return returns false if the run was cancelled
+*/
+bool hashDeltaBase(IfcParse::IfcFile &ifcfile, const std::string &inputFile, DeltaBase &base);
+
+/**
+* Write the difference between the base file and the given model
+* @param base index of the file the model was loaded from
+* @param ifcfile the (modified) model
+* @param deltaFile location to write the delta to
+* @return returns true upon success
+*/
+bool writeDelta(const DeltaBase &base, IfcParse::IfcFile &ifcfile, const std::string &deltaFile);
+
+/**
+* Stream the base file through the delta to produce the full output file
+* @param baseFile the IFC file the delta was computed against
+* @param deltaFile the delta to apply
+* @param outputFile location to write the resulting IFC file to
+* @return returns true upon success
+*/
+bool applyDelta(const std::string &baseFile, const std::string &deltaFile, const std::string &outputFile);
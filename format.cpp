@@ -0,0 +1,114 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "format.h"
+
+#include <iostream>
+
+/**
+* Get the scale of an SI unit from its prefix
+* @param unit the unit
+* @return returns the size of the unit relative to its unprefixed unit
+*/
+static double getSIUnitScale(IfcSchema::IfcSIUnit *unit)
+{
+	if (!unit->hasPrefix())
+		return 1;
+
+	switch (unit->Prefix())
+	{
+	case IfcSchema::IfcSIPrefix::IfcSIPrefix_KILO: return 1e3;
+	case IfcSchema::IfcSIPrefix::IfcSIPrefix_HECTO: return 1e2;
+	case IfcSchema::IfcSIPrefix::IfcSIPrefix_DECA: return 1e1;
+	case IfcSchema::IfcSIPrefix::IfcSIPrefix_DECI: return 1e-1;
+	case IfcSchema::IfcSIPrefix::IfcSIPrefix_CENTI: return 1e-2;
+	case IfcSchema::IfcSIPrefix::IfcSIPrefix_MILLI: return 1e-3;
+	case IfcSchema::IfcSIPrefix::IfcSIPrefix_MICRO: return 1e-6;
+	case IfcSchema::IfcSIPrefix::IfcSIPrefix_NANO: return 1e-9;
+	default:
+		std::cerr << "Warning: unsupported SI prefix, assuming none" << std::endl;
+		return 1;
+	}
+}
+
+/**
+* Get the length unit of the model from the units assigned to its project
+* @param ifcfile the current IFC File handler
+* @return returns the size of the length unit in metres, 1 if the model does not state it
+*/
+static double getLengthUnit(IfcParse::IfcFile &ifcfile)
+{
+	auto projects = ifcfile.entitiesByType("IfcProject");
+	if (!projects || !projects->size())
+		return 1;
+
+	auto project = dynamic_cast<IfcSchema::IfcProject*>(*projects->begin());
+#ifdef USE_IFC4
+	//optional from IFC4 onwards
+	if (!project->hasUnitsInContext())
+		return 1;
+#endif
+	auto units = project->UnitsInContext()->Units();
+	for (const auto &unit : *units)
+	{
+		if (auto siUnit = dynamic_cast<IfcSchema::IfcSIUnit*>(unit))
+		{
+			if (siUnit->UnitType() == IfcSchema::IfcUnitEnum::IfcUnit_LENGTHUNIT)
+				return getSIUnitScale(siUnit);
+		}
+		else if (auto convertedUnit = dynamic_cast<IfcSchema::IfcConversionBasedUnit*>(unit))
+		{
+			//e.g. feet, given as 0.3048 metres
+			if (convertedUnit->UnitType() == IfcSchema::IfcUnitEnum::IfcUnit_LENGTHUNIT)
+			{
+				auto factor = convertedUnit->ConversionFactor();
+				double value = *factor->ValueComponent()->entity->getArgument(0);
+				auto baseUnit = dynamic_cast<IfcSchema::IfcSIUnit*>(factor->UnitComponent());
+				return value * (baseUnit ? getSIUnitScale(baseUnit) : 1);
+			}
+		}
+	}
+	return 1;
+}
+
+EntityFormat getEntityFormat(IfcParse::IfcFile &ifcfile, const double &precision)
+{
+	if (precision <= 0)
+		return EntityFormat();
+
+	//Coordinates are in the unit of the model. Directions are rounded so they stray
+	//by no more than the precision over 100m.
+	return { RealFormat(precision / getLengthUnit(ifcfile)), RealFormat(precision / 100) };
+}
+
+void formatEntity(std::string &out, IfcUtil::IfcBaseClass *entity, const EntityFormat &format)
+{
+	if (entity->type() == IfcSchema::Type::IfcCartesianPoint)
+	{
+		auto point = dynamic_cast<IfcSchema::IfcCartesianPoint*>(entity);
+		format.length.appendEntity(out, entity->entity->id(), "IFCCARTESIANPOINT", point->Coordinates());
+	}
+	else if (entity->type() == IfcSchema::Type::IfcDirection)
+	{
+		auto direction = dynamic_cast<IfcSchema::IfcDirection*>(entity);
+		format.direction.appendEntity(out, entity->entity->id(), "IFCDIRECTION", direction->DirectionRatios());
+	}
+	else
+	{
+		out += entity->entity->toString(true);
+	}
+}
@@ -0,0 +1,57 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* Formatting of entities for output. Cartesian points and directions, which make up
+* the bulk of most models, are formatted here rather than by IfcOpenShell: with the
+* fewest digits that read back as the same coordinates, or rounded to a given precision.
+* Every writer goes through this, so a model reads the same whichever way it is written.
+*/
+
+#pragma once
+
+#include <ifcparse/IfcParse.h>
+#include <ifcparse/IfcFile.h>
+
+#include "numeric.h"
+
+#include <string>
+
+/**
+* Rounding of the reals written out
+*/
+struct EntityFormat
+{
+	RealFormat length;    //coordinates of cartesian points, in the unit of the model
+	RealFormat direction; //ratios of directions
+};
+
+/**
+* Get the format rounding a model to the given precision
+* @param ifcfile the model, its length unit is only looked up if a precision is given
+* @param precision multiples of this length coordinates are rounded to, in metres. 0 keeps them exact
+* @return returns the format to write the model with
+*/
+EntityFormat getEntityFormat(IfcParse::IfcFile &ifcfile, const double &precision);
+
+/**
+* Append an entity in STEP syntax, without the terminating ';'
+* @param out text to append to
+* @param entity entity to append
+* @param format rounding of the reals, exact by default
+*/
+void formatEntity(std::string &out, IfcUtil::IfcBaseClass *entity, const EntityFormat &format = EntityFormat());
@@ -17,13 +17,37 @@
 
 #include <ifcparse/IfcParse.h>
 #include <ifcparse/IfcFile.h>
+#include <ifcparse/IfcGlobalId.h>
 
+#include "delta.h"
+#include "format.h"
+#include "materiallibrary.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "renumber.h"
+#include "splitter.h"
+#include "step.h"
+#include "validator.h"
+#include "workingset.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <memory>
+#include <thread>
 #include <vector>
 
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 /**
 * Process a given line from a csv file and returns a vector of string
 * @param line the line to process
@@ -114,13 +138,17 @@ static std::map < std::string, std::pair<IfcSchema::IfcRelAssociatesMaterial*, I
 getRelMatMap(IfcParse::IfcFile &ifcfile)
 {
 	std::map < std::string, std::pair<IfcSchema::IfcRelAssociatesMaterial*, IfcSchema::IfcSurfaceStyle*> > matToIfcRelMat;
+	//IfcParse returns no list at all for types the file does not have, e.g. within a working set
 	auto materialEntities = ifcfile.entitiesByType("IfcMaterial");
+	if (!materialEntities)
+		materialEntities = IfcEntityList::ptr(new IfcEntityList());
 	for (const auto &en : *materialEntities)
 	{
 		auto mat = dynamic_cast<const IfcSchema::IfcMaterial*>(en);
 		if (mat)
 		{
 			auto ref = ifcfile.entitiesByReference(mat->entity->id());
+			if (!ref) continue;
 			for (auto &r : *ref)
 			{
 				if (r->type() == IfcSchema::Type::Enum::IfcRelAssociatesMaterial)
@@ -132,6 +160,8 @@ getRelMatMap(IfcParse::IfcFile &ifcfile)
 	}
 
 	auto surfaceItems = ifcfile.entitiesByType("IfcSurfaceStyle");
+	if (!surfaceItems)
+		surfaceItems = IfcEntityList::ptr(new IfcEntityList());
 	for (auto &en : *surfaceItems)
 	{
 		auto mat = dynamic_cast<IfcSchema::IfcSurfaceStyle*>(en);
@@ -636,6 +666,8 @@ std::map<IfcSchema::IfcRepresentationItem*, IfcSchema::IfcStyledItem*>
 	std::map<IfcSchema::IfcRepresentationItem*, IfcSchema::IfcStyledItem*> geoRepToStyle;
 
 	auto styledItem = ifcfile.entitiesByType("IfcStyledItem");
+	if (!styledItem)
+		return geoRepToStyle;
 	for (const auto &style : *styledItem)
 	{
 		auto s = dynamic_cast<IfcSchema::IfcStyledItem*>(style);
@@ -646,6 +678,42 @@ std::map<IfcSchema::IfcRepresentationItem*, IfcSchema::IfcStyledItem*>
 	return geoRepToStyle;
 }
 
+/**
+* Find the objects a metadata entry applies to, through the property sets holding it
+* @param ifcfile the current IFC File handler
+* @param metaId the IFC ID of the metadata
+* @param counters counters of the property sets that are used in other ways
+* @return returns the objects related to the property sets holding the metadata
+*/
+static std::vector<IfcSchema::IfcRoot*> getObjectsWithMetadata(IfcParse::IfcFile &ifcfile, const int &metaId, Counters &counters)
+{
+	std::vector<IfcSchema::IfcRoot*> objects;
+	auto refs = ifcfile.entitiesByReference(metaId);
+	if (refs)
+	{
+		for (const auto & r : *refs)
+		{
+			auto refs2 = ifcfile.entitiesByReference(r->entity->id());
+			if (!refs2)continue;
+			for (const auto & r2 : *refs2)
+			{
+				if (r2->type() == IfcSchema::Type::Enum::IfcRelDefinesByProperties)
+				{
+					auto relProp = dynamic_cast<const IfcSchema::IfcRelDefinesByProperties*>(r2);
+					auto relObjs = relProp->RelatedObjects();
+					objects.insert(objects.end(), relObjs->begin(), relObjs->end());
+				}
+				else
+				{
+					//e.g. the property sets of type objects
+					counters.add("property sets ignored, referenced by", IfcSchema::Type::ToString(r2->type()));
+				}
+			}
+		}
+	}
+	return objects;
+}
+
 /**
 * Given a metadata ID, update all its references with the given material
 * @param ifcfile the current IFC File handler
@@ -657,6 +725,7 @@ std::map<IfcSchema::IfcRepresentationItem*, IfcSchema::IfcStyledItem*>
 * @param geoList A global list tracker to track the IFC Representation seen
 * @param geoRepToStyle A mapping of representation items to its styled Item
 * @param newEntities A list to keep track of new entities that needs to be added into the IFC file after
+* @param counters counters of the unexpected cases met along the way
 */
 void updateMaterial(
 	IfcParse::IfcFile                                                     &ifcfile,
@@ -667,8 +736,8 @@ void updateMaterial(
 	std::set<IfcSchema::IfcRepresentationMap*>                             &seenMaps,
 	std::set<IfcSchema::IfcRepresentation*>                                &geoReps,
 	std::map<IfcSchema::IfcRepresentationItem*, IfcSchema::IfcStyledItem*> &geoRepToStyle,
-	IfcEntityList::ptr                                                     &newEntities
-
+	IfcEntityList::ptr                                                     &newEntities,
+	Counters                                                               &counters
 )
 {
 	
@@ -682,41 +751,19 @@ void updateMaterial(
 		objs.insert(relatingObjects->begin(), relatingObjects->end());
 	}	
 
-	auto refs = ifcfile.entitiesByReference(metaId);
-	if (refs)
+	for (const auto & r3 : getObjectsWithMetadata(ifcfile, metaId, counters))
 	{
-		for (const auto & r : *refs)
+		auto relProd = dynamic_cast<const IfcSchema::IfcProduct*>(r3);
+		std::set<IfcSchema::IfcGeometricRepresentationItem*> pGeoItems = findGeoRepItems(relProd, geoList, geoReps, seenMaps, ifcfile);
+		geoItems.insert(pGeoItems.begin(), pGeoItems.end());
+		geoList.insert(pGeoItems.begin(), pGeoItems.end());
+
+		if (material && objs.find(r3) == objs.end())
 		{
-			auto refs2 = ifcfile.entitiesByReference(r->entity->id());
-			if (!refs2)continue;
-			for (const auto & r2 : *refs2)
-			{
-				if (r2->type() == IfcSchema::Type::Enum::IfcRelDefinesByProperties)
-				{
-					auto relProp = dynamic_cast<const IfcSchema::IfcRelDefinesByProperties*>(r2);
-					auto relObjs = relProp->RelatedObjects();
-					for (const auto & r3 : *relObjs)
-					{
-						auto relProd = dynamic_cast<const IfcSchema::IfcProduct*>(r3);
-						std::set<IfcSchema::IfcGeometricRepresentationItem*> pGeoItems = findGeoRepItems(relProd, geoList, geoReps, seenMaps, ifcfile);
-						geoItems.insert(pGeoItems.begin(), pGeoItems.end());
-						geoList.insert(pGeoItems.begin(), pGeoItems.end());
-
-						if (objs.find(r3) == objs.end())
-						{
-							relatingObjects->push(r3);
-						}
-					}
-				}
-				else
-				{
-					std::cerr << "Unexpected type : " << r2->type() << std::endl;
-					std::cout << r2->entity->toString() << std::endl;
-				}
-			}
+			relatingObjects->push(r3);
 		}
 	}
-	
+
 
 	//Add objects to Material link
 	if (material)
@@ -750,36 +797,174 @@ void updateMaterial(
 }
 
 /**
-* Update the IFC with materials depicted from the given matMap
-* This function will update the IFC and writes the results in outputFile
-* @param inputFile input IFC file
-* @param outputFile output IFC file
-* @param matMap a map of {Metadata Field name , {Metadata Value, Material Name}}
+* An IFC model loaded in memory, along with the indices required to apply material overrides
 */
-static void updateFile(const std::string &inputFile, const std::string &outputfile,
-	const std::map<std::string, std::map<std::string, std::string>> &matMap)
+struct IfcModel
 {
+	/**
+	* An entry copied from the material library. The copies within ifcfile are made from its entities,
+	* so it is declared first to outlive them.
+	*/
+	struct LibraryImport
+	{
+		std::string       text;
+		IfcParse::IfcFile ifcfile;
+	};
+	std::vector<std::unique_ptr<LibraryImport>> imports;
+
+	std::string       inputFile;
 	IfcParse::IfcFile ifcfile;
+	std::map<IfcSchema::IfcRepresentationItem*, IfcSchema::IfcStyledItem*> geoRepToStyle;
+	std::map < std::string, std::pair<IfcSchema::IfcRelAssociatesMaterial*, IfcSchema::IfcSurfaceStyle*> > matToIfcRelMat;
+	const MaterialLibrary *library = nullptr; //where to find materials the model does not have
+	std::vector<IfcSchema::IfcRelAssociatesMaterial*> importedRels; //associations of the imported materials, not yet added to ifcfile
+};
+
+/**
+* A rule set to apply and the location to write the result to
+* first: output IFC file, second: a map of {Metadata Field name , {Metadata Value, Material Name}}
+*/
+typedef std::pair<std::string, std::map<std::string, std::map<std::string, std::string>>> Variant;
+
+/**
+* Options given on the command line
+*/
+struct Options
+{
+	bool delta = false;    //write the changes against the input file rather than the full model
+	bool renumber = false; //renumber the entities of the output in a dense, locality preserving order
+	bool pipeline = false; //overlap the stages of a run with one another
+	size_t memoryLimit = 0; //if set, only the working set of the override is loaded, in bytes
+	bool validate = false;  //check the referential integrity of the output
+	std::string materialLibrary; //if set, IFC file to copy materials missing from the model from
+	double precision = 0;   //if set, coordinates are rounded to multiples of this length, in metres
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+/**
+* Parse the IFC file
+* @param inputFile input IFC file
+* @param ifcfile IFC File handler to initialise
+* @return returns false upon failure, or if the run was cancelled meanwhile
+*/
+static bool parseFile(const std::string &inputFile, IfcParse::IfcFile &ifcfile)
+{
+	//Parsing cannot be followed or interrupted, it is only reported once done
+	uint64_t size = std::ifstream(inputFile, std::ios::binary | std::ios::ate).tellg();
+	Progress progress("parse", inputFile, size);
 	if (!ifcfile.Init(inputFile))
 	{
 		std::cerr << "Failed initialising " << inputFile << std::endl;
-		return;
+		return false;
+	}
+	if (!progress.update(0, size))
+		return false;
+	progress.finish();
+	return true;
+}
+
+/**
+* Load the IFC file and build the indices needed by the material override
+* @param inputFile input IFC file
+* @param model model to populate
+* @return returns true upon success
+*/
+static bool loadModel(const std::string &inputFile, IfcModel &model)
+{
+	model.inputFile = inputFile;
+	if (!parseFile(inputFile, model.ifcfile))
+		return false;
+
+	model.geoRepToStyle = getStyleItemForGeoReps(model.ifcfile);
+	model.matToIfcRelMat = getRelMatMap(model.ifcfile);
+	return true;
+}
+
+/**
+* Copy a material the model does not have from the material library, along with its surface style
+* @param model model to copy the material into
+* @param name name of the material
+* @return returns the entry of the material within model.matToIfcRelMat, end() if the library does not have it either
+*/
+static std::map<std::string, std::pair<IfcSchema::IfcRelAssociatesMaterial*, IfcSchema::IfcSurfaceStyle*>>::iterator
+importMaterial(IfcModel &model, const std::string &name)
+{
+	auto &matMap = model.matToIfcRelMat;
+	if (!model.library)
+		return matMap.end();
+
+	std::unique_ptr<IfcModel::LibraryImport> import(new IfcModel::LibraryImport());
+	import->text = model.library->find(name);
+	if (import->text.empty())
+		return matMap.end();
+
+	//IfcParse reads the entities from the text as they are accessed, so it is kept along with the model
+	if (!import->ifcfile.Init(&import->text[0], import->text.size()))
+	{
+		std::cerr << "Failed to read material " << name << " from the material library" << std::endl;
+		return matMap.end();
+	}
+
+	//Entities of another file are copied in, along with everything they reference
+	IfcSchema::IfcMaterial *material = nullptr;
+	IfcSchema::IfcSurfaceStyle *style = nullptr;
+	auto materials = import->ifcfile.entitiesByType("IfcMaterial");
+	if (materials && materials->size())
+		material = dynamic_cast<IfcSchema::IfcMaterial*>(model.ifcfile.addEntity(*materials->begin()));
+	auto styles = import->ifcfile.entitiesByType("IfcSurfaceStyle");
+	if (styles && styles->size())
+		style = dynamic_cast<IfcSchema::IfcSurfaceStyle*>(model.ifcfile.addEntity(*styles->begin()));
+
+	//Names the library only knows as a surface style get a material of their own, so the
+	//objects are associated with a material as they are when the model has the material
+	if (!material)
+	{
+		material = new IfcSchema::IfcMaterial(name);
+		model.ifcfile.addEntity(material);
 	}
 
-	auto geoRepToStyle = getStyleItemForGeoReps(ifcfile);
-	auto matToIfcRelMat = getRelMatMap(ifcfile);
+	//The objects are added to the relationship by the override. It is only added to the model once
+	//the override is done, if it relates anything: the objects may all turn out to be type objects.
+	auto histories = model.ifcfile.entitiesByType("IfcOwnerHistory");
+	auto ownerHistory = histories && histories->size() ? dynamic_cast<IfcSchema::IfcOwnerHistory*>(*histories->begin()) : nullptr;
+	IfcTemplatedEntityList<IfcSchema::IfcRoot>::ptr relatedObjects(new IfcTemplatedEntityList<IfcSchema::IfcRoot>());
+	auto rel = new IfcSchema::IfcRelAssociatesMaterial(IfcParse::IfcGlobalId(), ownerHistory, boost::none, boost::none, relatedObjects, material);
+	model.importedRels.push_back(rel);
+
+	model.imports.push_back(std::move(import));
+	return matMap.insert({ name, { rel, style } }).first;
+}
+
+/**
+* Update the model with materials depicted from the given matMap
+* @param model model to update
+* @param matMap a map of {Metadata Field name , {Metadata Value, Material Name}}
+* @return returns false if the run was cancelled
+*/
+static bool applyMaterialMap(IfcModel &model,
+	const std::map<std::string, std::map<std::string, std::string>> &matMap)
+{
+	auto &ifcfile = model.ifcfile;
+	Counters counters;
 
 	//Entity tracker
 	std::set<IfcSchema::IfcRepresentationItem*> geoList;
 	std::set<IfcSchema::IfcRepresentationMap*> seenMaps;
 	std::set<IfcSchema::IfcRepresentation*> geoReps;
 
+	//A working set holds no metadata at all if the rules match nothing
 	auto metadataEntities = ifcfile.entitiesByType("IfcPropertySingleValue");
+	if (!metadataEntities)
+		metadataEntities = IfcEntityList::ptr(new IfcEntityList());
 	IfcEntityList::ptr newEntities(new IfcEntityList());
+	Progress progress("override", model.inputFile, 0, metadataEntities->size());
 	
 	//Loop through all Metadata entities to find matching metadata field
 	for (const auto &meta : *metadataEntities)
 	{
+		if (!progress.add(1))
+			return false;
+
 		auto singleProp = dynamic_cast<const IfcSchema::IfcPropertySingleValue*>(meta);
 		if (singleProp->hasNominalValue())
 		{
@@ -790,15 +975,22 @@ static void updateFile(const std::string &inputFile, const std::string &outputfi
 				auto valueIt = valueMap.find(singleProp->NominalValue()->valueAsString());
 				if (valueIt != valueMap.end())
 				{
-					auto matIt = matToIfcRelMat.find(valueIt->second);
-					if (matIt != matToIfcRelMat.end())
+					auto matIt = model.matToIfcRelMat.find(valueIt->second);
+					if (matIt == model.matToIfcRelMat.end())
+					{
+						matIt = importMaterial(model, valueIt->second);
+						if (matIt != model.matToIfcRelMat.end())
+							counters.add("materials copied from the material library");
+					}
+					if (matIt != model.matToIfcRelMat.end())
 					{
 						//This Metadata Field/Value has a new material. Find all references and update them
-						updateMaterial(ifcfile, matIt->second.first, matIt->second.second, singleProp->entity->id(), geoList, seenMaps, geoReps, geoRepToStyle, newEntities);
+						updateMaterial(ifcfile, matIt->second.first, matIt->second.second, singleProp->entity->id(), geoList, seenMaps, geoReps, model.geoRepToStyle, newEntities, counters);
+						counters.add("properties matched");
 					}
 					else
 					{
-						std::cerr << "Failed to find material " << valueIt->second << std::endl;
+						counters.add("properties matched to missing material", valueIt->second);
 					}
 
 
@@ -807,16 +999,361 @@ static void updateFile(const std::string &inputFile, const std::string &outputfi
 		}
 		else
 		{
-			std::cout << "no nominal value: " << meta->entity->toString() << std::endl;
+			counters.add("properties without a nominal value");
 		}
 	}
 	
+	//RelatedObjects of a material association cannot be empty, those left unused are dropped
+	std::set<IfcSchema::IfcRelAssociatesMaterial*> unused;
+	for (const auto &rel : model.importedRels)
+	{
+		if (rel->RelatedObjects()->size())
+			newEntities->push(rel);
+		else
+			unused.insert(rel);
+	}
+	model.importedRels.clear();
+	for (auto it = model.matToIfcRelMat.begin(); it != model.matToIfcRelMat.end();)
+	{
+		if (unused.count(it->second.first))
+			it = model.matToIfcRelMat.erase(it);
+		else
+			++it;
+	}
+	for (const auto &rel : unused)
+		delete rel;
+
 	//Add all the new entities into the ifc
 	ifcfile.addEntities(newEntities);
-	
-	std::ofstream os(outputfile);
-	os << ifcfile;
-	os.close();
+	progress.finish();
+	counters.report(std::cout, "Override of " + model.inputFile + ":");
+	return true;
+}
+
+/**
+* Write the model out to the given file, rounded to the precision requested. When pipelined, the entities are formatted into shards that are written out on a
+* separate thread as the following ones are formatted. The header is taken from the input file.
+* @param model model to write
+* @param outputFile output IFC file
+* @param options options of this run
+* @return returns true upon success
+*/
+static bool writeModelText(IfcModel &model, const std::string &outputFile, const Options &options)
+{
+	StepFile input;
+	if (!input.open(model.inputFile))
+		return false;
+
+	auto format = getEntityFormat(model.ifcfile, options.precision);
+
+	std::unique_ptr<ShardWriter> writer;
+	std::ofstream os;
+	if (options.pipeline)
+		writer.reset(new ShardWriter(outputFile));
+	else
+		os.open(outputFile, std::ios::binary);
+
+	auto write = [&](const std::string &text)
+	{
+		if (writer)
+			writer->append(text);
+		else
+			os.write(text.data(), text.size());
+	};
+
+	write(input.header() + "\n");
+	std::string text;
+	Progress progress("write", outputFile, 0, std::distance(model.ifcfile.begin(), model.ifcfile.end()));
+	for (auto it = model.ifcfile.begin(); it != model.ifcfile.end() && !cancelled(); ++it)
+	{
+		text.clear();
+		formatEntity(text, it->second, format);
+		text += ";\n";
+		write(text);
+		progress.add(1, text.size());
+	}
+	write(input.trailer());
+
+	bool written;
+	if (writer)
+	{
+		written = writer->finish();
+	}
+	else
+	{
+		os.close();
+		written = !os.fail();
+	}
+
+	//never leave a partial model behind
+	if (cancelled())
+	{
+		std::remove(outputFile.c_str());
+		return false;
+	}
+
+	if (!written)
+	{
+		std::cerr << "Failed to write " << outputFile << std::endl;
+		return false;
+	}
+	progress.finish();
+	return true;
+}
+
+/**
+* Write the model out to the given file
+* @param model model to write
+* @param outputFile output file
+* @param options options of this run
+* @param deltaBase if given, only the changes against this base are written
+* @return returns true upon success
+*/
+static bool writeModel(IfcModel &model, const std::string &outputFile, const Options &options, const DeltaBase *deltaBase)
+{
+	if (deltaBase)
+		return writeDelta(*deltaBase, model.ifcfile, outputFile);
+
+	auto file = options.renumber ? outputFile + ".tmp" : outputFile;
+	if (!writeModelText(model, file, options))
+		return false;
+
+	if (options.renumber)
+	{
+		bool success = renumberFile(file, outputFile);
+		std::remove(file.c_str());
+		if (!success)
+			return false;
+	}
+
+	return !options.validate || validateFile(outputFile, options.threads);
+}
+
+#ifndef _WIN32
+/**
+* Apply each variant within its own forked process. The children share the
+* parsed model and its indices with this process copy-on-write, so the model
+* is only parsed once no matter how many variants there are.
+* @param model the loaded model, left untouched
+* @param variants list of variants to produce
+* @param options options of this run
+* @param deltaBase if given, only the changes against this base are written
+* @return returns true if every variant was produced
+*/
+static bool forkVariants(IfcModel &model, const std::vector<Variant> &variants, const Options &options, const DeltaBase *deltaBase)
+{
+	std::map<pid_t, std::string> running;
+	bool stopping = false;
+	bool success = true;
+
+	auto waitForChild = [&]()
+	{
+		int status;
+		auto pid = wait(&status);
+
+		//wait() returns early upon a signal. A SIGTERM is only sent to this process, pass it on.
+		if (cancelled() && !stopping)
+		{
+			stopping = true;
+			for (const auto &child : running)
+				kill(child.first, SIGTERM);
+		}
+		if (pid <= 0) return;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+		{
+			std::cerr << "Failed to produce " << running[pid] << std::endl;
+			success = false;
+		}
+		running.erase(pid);
+	};
+
+	std::cout.flush();
+	std::cerr.flush();
+	for (const auto &variant : variants)
+	{
+		while (running.size() >= options.threads)
+			waitForChild();
+		if (cancelled())
+		{
+			success = false;
+			break;
+		}
+
+		auto pid = fork();
+		if (pid == 0)
+		{
+			bool written = applyMaterialMap(model, variant.second)
+				&& writeModel(model, variant.first, options, deltaBase);
+			std::cout.flush();
+			//skip the teardown of the model, the parent still owns it
+			_exit(written ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+		else if (pid < 0)
+		{
+			std::cerr << "Failed to fork a process for " << variant.first << std::endl;
+			success = false;
+		}
+		else
+		{
+			running[pid] = variant.first;
+		}
+	}
+
+	while (running.size())
+		waitForChild();
+	return success;
+}
+#endif
+
+/**
+* Update the IFC with materials depicted from each variant's matMap
+* The IFC file is parsed once and every variant is written to its own output file
+* @param inputFile input IFC file
+* @param variants list of {output IFC file, matMap} to produce
+* @param options options of this run
+* @param library material library to copy missing materials from, if any
+* @return returns true if every variant was written, and passed validation if requested
+*/
+static bool updateFile(const std::string &inputFile, const std::vector<Variant> &variants, const Options &options,
+	const MaterialLibrary *library)
+{
+	std::unique_ptr<DeltaBase> deltaBase;
+	std::thread indexer;
+	bool indexed = true;
+	if (options.delta)
+	{
+		//Counting the records only needs the raw file, in pipeline mode do it while the model is being parsed
+		deltaBase.reset(new DeltaBase());
+		if (options.pipeline)
+			indexer = std::thread([&]() { indexed = indexDeltaBase(inputFile, *deltaBase); });
+		else if (!indexDeltaBase(inputFile, *deltaBase))
+			return false;
+	}
+
+	std::unique_ptr<IfcModel> model(new IfcModel());
+	bool loaded = loadModel(inputFile, *model);
+	model->library = library;
+	if (indexer.joinable())
+		indexer.join();
+	if (!loaded || !indexed)
+		return false;
+
+	//Changes are told apart from the model as loaded, however the input file was formatted
+	if (deltaBase && !hashDeltaBase(model->ifcfile, inputFile, *deltaBase))
+		return false;
+
+	if (variants.size() == 1)
+	{
+		return applyMaterialMap(*model, variants[0].second)
+			&& writeModel(*model, variants[0].first, options, deltaBase.get());
+	}
+
+#ifndef _WIN32
+	return forkVariants(*model, variants, options, deltaBase.get());
+#else
+	//No copy-on-write processes available, reload the model for every subsequent variant
+	bool success = true;
+	for (size_t i = 0; i < variants.size(); ++i)
+	{
+		if (i)
+		{
+			model.reset(new IfcModel());
+			if (!loadModel(inputFile, *model))
+				return false;
+			model->library = library;
+		}
+		if (!applyMaterialMap(*model, variants[i].second)
+			|| !writeModel(*model, variants[i].first, options, deltaBase.get()))
+		{
+			success = false;
+		}
+	}
+	return success;
+#endif
+}
+
+/**
+* Update the IFC with materials depicted from each variant's matMap, without ever
+* loading the whole input file. Only the working set of the rules is loaded, and
+* the changes are merged back in by streaming the input file through them.
+* @param inputFile input IFC file
+* @param variants list of {output IFC file, matMap} to produce
+* @param options options of this run
+* @param library material library to copy missing materials from, if any
+* @return returns true if every variant was written, and passed validation if requested
+*/
+static bool updateFileWithinBudget(const std::string &inputFile, const std::vector<Variant> &variants, const Options &options,
+	const MaterialLibrary *library)
+{
+	//The working set has to cover the rules of every variant
+	std::map<std::string, std::map<std::string, std::string>> rules;
+	for (const auto &variant : variants)
+	{
+		for (const auto &field : variant.second)
+			rules[field.first].insert(field.second.begin(), field.second.end());
+	}
+
+	auto subsetFile = variants[0].first + ".workingset.ifc";
+	DeltaBase base;
+	bool success = extractWorkingSet(inputFile, rules, subsetFile, options.memoryLimit, base);
+	if (success)
+	{
+		for (const auto &variant : variants)
+		{
+			IfcModel model;
+			model.library = library;
+			if (!loadModel(subsetFile, model) || !hashDeltaBase(model.ifcfile, subsetFile, base)
+				|| !applyMaterialMap(model, variant.second))
+			{
+				success = false;
+				break;
+			}
+
+			//The delta of the working set is a delta of the input file, as the ids are the same
+			auto deltaFile = options.delta ? variant.first : variant.first + ".delta.tmp";
+			if (!writeDelta(base, model.ifcfile, deltaFile))
+			{
+				success = false;
+				continue;
+			}
+			if (options.delta)
+				continue;
+
+			bool written = applyDelta(inputFile, deltaFile, variant.first);
+			std::remove(deltaFile.c_str());
+
+			if (written && options.validate)
+				written = validateFile(variant.first, options.threads);
+			success = success && written;
+			if (cancelled())
+			{
+				success = false;
+				break;
+			}
+		}
+	}
+
+	std::remove(subsetFile.c_str());
+	return success;
+}
+
+/**
+* Parse a size given on the command line, e.g. 512M or 16G
+* @param arg the argument to parse
+* @return returns the size in bytes, 0 if it is invalid
+*/
+static size_t parseSize(const std::string &arg)
+{
+	char *unit = nullptr;
+	auto size = std::strtod(arg.c_str(), &unit);
+	switch (std::toupper(*unit))
+	{
+	case 'K': size *= 1 << 10; break;
+	case 'M': size *= 1 << 20; break;
+	case 'G': size *= 1 << 30; break;
+	case 'T': size *= 1ULL << 40; break;
+	}
+	return size > 0 ? size_t(size) : 0;
 }
 
 /**
@@ -833,48 +1370,499 @@ static bool fileExists(const std::string &file)
 }
 
 /**
-* Process the IFC file based on the conditions within the CSV File
-* the function will read from inputFile and csvFile and writes the resulting 
-* IFC file in outputFile
+* Process the IFC file based on the conditions within the CSV Files
+* the function will read from inputFile and each csvFile and writes the resulting 
+* IFC files in their respective outputFile
 * @params inputFile location of input IFC file
-* @params where to write the output file
-* @params csvFile location of the CSV file
+* @params outputs list of {where to write the output file, location of the CSV file}
+* @params options options of this run
+* @return returns true if every output file was written, and passed validation if requested
 */
-static void processIFC(const std::string &inputFile, const std::string &outputFile, const std::string &csvFile)
+static bool processIFC(const std::string &inputFile, const std::vector<std::pair<std::string, std::string>> &outputs,
+	const Options &options)
 {
-	auto matMap = processCSVFile(csvFile);
-
-	if (matMap.size())
+	std::vector<Variant> variants;
+	for (const auto &output : outputs)
 	{
-		for (const auto &item : matMap)
+		auto matMap = processCSVFile(output.second);
+
+		if (matMap.size())
 		{
-			std::cout << item.first << ":" << std::endl;
-			for (const auto &pair : item.second)
+			std::cout << output.second << " -> " << output.first << std::endl;
+			for (const auto &item : matMap)
 			{
-				std::cout << "\t" << pair.first << " : " << pair.second << std::endl;
+				std::cout << item.first << ":" << std::endl;
+				for (const auto &pair : item.second)
+				{
+					std::cout << "\t" << pair.first << " : " << pair.second << std::endl;
+				}
 			}
+
+			variants.push_back({ output.first, matMap });
+		}
+		else
+		{
+			std::cerr << "Cannot find mappings from csv file " << output.second << "!" << std::endl;
+		}
+	}
+
+	if (variants.empty())
+		return false;
+
+	//The library is mapped once, variants forked off share it
+	MaterialLibrary library;
+	if (options.materialLibrary.size() && !library.open(options.materialLibrary))
+		return false;
+	auto libraryPtr = options.materialLibrary.size() ? &library : nullptr;
+
+	bool success = options.memoryLimit
+		? updateFileWithinBudget(inputFile, variants, options, libraryPtr)
+		: updateFile(inputFile, variants, options, libraryPtr);
+
+	//Variants without mappings were not written at all
+	return success && variants.size() == outputs.size();
+}
+
+/**
+* A way of splitting a model: map of {part name, ids of the products within the part}
+*/
+typedef std::map<std::string, std::vector<unsigned>> Parts;
+
+/**
+* Group the products of a model by the spatial structure element of the given type
+* they are contained in, directly or through the spaces and storeys aggregated into it
+* @param ifcfile the current IFC File handler
+* @param type type of the element to group by, i.e. IfcBuildingStorey or IfcBuilding
+* @return returns the products within each element, by element name
+*/
+static Parts groupBySpatialStructure(IfcParse::IfcFile &ifcfile, const IfcSchema::Type::Enum &type)
+{
+	std::map<IfcSchema::IfcObjectDefinition*, IfcSchema::IfcObjectDefinition*> parents;
+	auto aggregates = ifcfile.entitiesByType("IfcRelAggregates");
+	if (aggregates)
+	{
+		for (const auto &en : *aggregates)
+		{
+			auto rel = dynamic_cast<IfcSchema::IfcRelAggregates*>(en);
+			auto children = rel->RelatedObjects();
+			for (const auto &child : *children)
+				parents[child] = rel->RelatingObject();
+		}
+	}
+
+	//Walk up the decomposition until an element of the given type is found
+	auto getOwner = [&](IfcSchema::IfcObjectDefinition *obj) -> IfcSchema::IfcObjectDefinition*
+	{
+		for (size_t depth = 0; obj && obj->type() != type && depth <= parents.size(); ++depth)
+		{
+			auto it = parents.find(obj);
+			obj = it == parents.end() ? nullptr : it->second;
+		}
+		return obj && obj->type() == type ? obj : nullptr;
+	};
+
+	//Elements sharing a name are told apart by their id
+	std::map<IfcSchema::IfcObjectDefinition*, std::string> ownerNames;
+	std::set<std::string> usedNames;
+	Parts parts;
+	auto addToPart = [&](IfcSchema::IfcObjectDefinition *owner, IfcUtil::IfcBaseClass *product)
+	{
+		auto it = ownerNames.find(owner);
+		if (it == ownerNames.end())
+		{
+			auto name = owner->hasName() ? owner->Name() : owner->GlobalId();
+			if (!usedNames.insert(name).second)
+				name += "_" + std::to_string(owner->entity->id());
+			it = ownerNames.insert({ owner, name }).first;
 		}
+		parts[it->second].push_back(product->entity->id());
+	};
 
-		updateFile(inputFile, outputFile, matMap);
+	auto containment = ifcfile.entitiesByType("IfcRelContainedInSpatialStructure");
+	if (containment)
+	{
+		for (const auto &en : *containment)
+		{
+			auto rel = dynamic_cast<IfcSchema::IfcRelContainedInSpatialStructure*>(en);
+			auto owner = getOwner(rel->RelatingStructure());
+			if (!owner) continue;
+			auto elements = rel->RelatedElements();
+			for (const auto &element : *elements)
+				addToPart(owner, element);
+		}
 	}
-	else
+
+	//Spaces, and storeys when grouping by building, belong to their part as well
+	for (const auto &parent : parents)
+	{
+		auto child = parent.first;
+		if (child->type() == type || !dynamic_cast<IfcSchema::IfcSpatialStructureElement*>(child))
+			continue;
+		if (auto owner = getOwner(child))
+			addToPart(owner, child);
+	}
+
+	return parts;
+}
+
+/**
+* Group the products of a model by the value of a metadata field
+* @param ifcfile the current IFC File handler
+* @param field name of the metadata field
+* @return returns the products holding each value of the field, by value
+*/
+static Parts groupByMetadata(IfcParse::IfcFile &ifcfile, const std::string &field)
+{
+	Parts parts;
+	Counters counters;
+	auto metadataEntities = ifcfile.entitiesByType("IfcPropertySingleValue");
+	if (!metadataEntities)
+		return parts;
+	for (const auto &meta : *metadataEntities)
+	{
+		auto singleProp = dynamic_cast<const IfcSchema::IfcPropertySingleValue*>(meta);
+		if (singleProp->Name() != field || !singleProp->hasNominalValue())
+			continue;
+
+		auto &part = parts[singleProp->NominalValue()->valueAsString()];
+		for (const auto &obj : getObjectsWithMetadata(ifcfile, singleProp->entity->id(), counters))
+		{
+			if (dynamic_cast<IfcSchema::IfcProduct*>(obj))
+				part.push_back(obj->entity->id());
+		}
+	}
+	counters.report(std::cout, "Grouping by " + field + ":");
+	return parts;
+}
+
+/**
+* Gather the products left out of every part into a part of their own, so nothing is lost by
+* splitting: e.g. products contained directly in a site or building when splitting by storey,
+* products outside of the spatial structure, or products without the field when splitting by field.
+* Products decomposing a product of a part, openings and ports come along with it already.
+* @param ifcfile the current IFC File handler
+* @param common ids of the entities every part holds
+* @param parts parts to add the remainder to
+*/
+static void addUnassigned(IfcParse::IfcFile &ifcfile, const std::vector<unsigned> &common, Parts &parts)
+{
+	std::set<unsigned> assigned, shared(common.begin(), common.end());
+	for (const auto &part : parts)
+		assigned.insert(part.second.begin(), part.second.end());
+
+	std::map<unsigned, unsigned> parents;
+	auto aggregates = ifcfile.entitiesByType("IfcRelAggregates");
+	if (aggregates)
+	{
+		for (const auto &en : *aggregates)
+		{
+			auto rel = dynamic_cast<IfcSchema::IfcRelAggregates*>(en);
+			auto children = rel->RelatedObjects();
+			for (const auto &child : *children)
+				parents[child->entity->id()] = rel->RelatingObject()->entity->id();
+		}
+	}
+
+	auto isAssigned = [&](unsigned id)
+	{
+		for (size_t depth = 0; depth <= parents.size(); ++depth)
+		{
+			if (assigned.count(id))
+				return true;
+			auto it = parents.find(id);
+			if (it == parents.end())
+				return false;
+			id = it->second;
+		}
+		return false;
+	};
+
+	std::vector<unsigned> unassigned;
+	auto products = ifcfile.entitiesByType("IfcProduct");
+	if (products)
+	{
+		for (const auto &product : *products)
+		{
+			auto id = product->entity->id();
+			if (shared.count(id) || dynamic_cast<IfcSchema::IfcFeatureElement*>(product) || dynamic_cast<IfcSchema::IfcPort*>(product))
+				continue;
+			if (!isAssigned(id))
+				unassigned.push_back(id);
+		}
+	}
+	if (unassigned.empty())
+		return;
+
+	std::string name = "unassigned";
+	for (int i = 2; parts.count(name); ++i)
+		name = "unassigned_" + std::to_string(i);
+	std::cerr << "Warning: " << unassigned.size() << " products are not within any part, they are written to the part " << name << std::endl;
+	parts[name] = unassigned;
+}
+
+/**
+* Split the IFC file into one file per storey, building or value of a metadata field.
+* The model is only parsed to group the products, the parts are then extracted from
+* the file itself, several at a time.
+* @param inputFile location of input IFC file
+* @param outputPrefix each part is written to <outputPrefix>_<part name>.ifc
+* @param mode "storey", "building" or "field"
+* @param field name of the metadata field when splitting by field
+* @param threads maximum number of parts written in parallel
+* @return returns true upon success
+*/
+static bool splitIFC(const std::string &inputFile, const std::string &outputPrefix,
+	const std::string &mode, const std::string &field, const unsigned &threads)
+{
+	Parts parts;
+	std::vector<unsigned> common;
+	{
+		IfcParse::IfcFile ifcfile;
+		if (!parseFile(inputFile, ifcfile))
+			return false;
+
+		if (mode == "storey")
+			parts = groupBySpatialStructure(ifcfile, IfcSchema::Type::IfcBuildingStorey);
+		else if (mode == "building")
+			parts = groupBySpatialStructure(ifcfile, IfcSchema::Type::IfcBuilding);
+		else
+			parts = groupByMetadata(ifcfile, field);
+
+		//Every part keeps the project and its spatial structure, so it can be federated with the others
+		for (const auto &type : { "IfcProject", "IfcSite", "IfcBuilding", "IfcBuildingStorey" })
+		{
+			auto entities = ifcfile.entitiesByType(type);
+			if (!entities) continue;
+			for (const auto &en : *entities)
+				common.push_back(en->entity->id());
+		}
+
+		addUnassigned(ifcfile, common, parts);
+	}
+
+	if (parts.empty())
 	{
-		std::cerr << "Cannot find mappings from csv file!" << std::endl;
+		std::cerr << "Nothing to split " << inputFile << " by" << std::endl;
+		return false;
 	}
 
+	return splitFile(inputFile, parts, common, outputPrefix, threads);
+}
+
+/**
+* Print the usage of the program
+* @param program name of the executable
+*/
+static void printUsage(const char *program)
+{
+	std::cerr << "Usage: " << program << " [options] <input file> <output file> <csv file> [<output file> <csv file> ...]" << std::endl;
+	std::cerr << "       " << program << " apply <base IFC file> <delta file> <output file>" << std::endl;
+	std::cerr << "       " << program << " validate [--threads <n>] <IFC file>" << std::endl;
+	std::cerr << "       " << program << " split [--threads <n>] <input file> <output prefix> storey|building|field <metadata field>" << std::endl;
+	std::cerr << "       " << program << " library <library IFC file>" << std::endl;
+	std::cerr << "Options:" << std::endl;
+	std::cerr << "\t--delta\t\twrite the changes against the input file instead of the full model" << std::endl;
+	std::cerr << "\t--renumber\trenumber the output entities densely, placing entities next to the ones they reference" << std::endl;
+	std::cerr << "\t--pipeline\tindex the input for --delta while parsing, and write the output while formatting it" << std::endl;
+	std::cerr << "\t--threads <n>\tmaximum number of variants processed in parallel, and of validation threads (default: number of cores)" << std::endl;
+	std::cerr << "\t--memory-limit <size>\tonly load the part of the model the override needs, refusing to start if it is estimated to need more than the given size (e.g. 16G)" << std::endl;
+	std::cerr << "\t--validate\tcheck the referential integrity of the output files" << std::endl;
+	std::cerr << "\t--progress-fd <fd>\tsend progress events to the given file descriptor instead of stderr" << std::endl;
+	std::cerr << "\t--precision <length>\tround coordinates to multiples of the given length in metres (e.g. 0.0001), shrinking the output" << std::endl;
+	std::cerr << "\t--material-library <file>\tcopy materials missing from the model from the given IFC file" << std::endl;
 }
 
 int main(int argc, char* argv[])
 {
-	if (argc < 4)
+	installCancellationHandler();
+
+	if (argc > 1 && std::string(argv[1]) == "apply")
+	{
+		if (argc != 5)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		for (int i = 2; i < 4; ++i)
+		{
+			if (!fileExists(argv[i]))
+			{
+				std::cerr << "Error: Cannot find file " << argv[i] << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+
+		return applyDelta(argv[2], argv[3], argv[4]) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "validate")
+	{
+		unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+		int fileArg = 2;
+		if (argc == 5 && std::string(argv[2]) == "--threads")
+		{
+			threads = std::max(1, std::atoi(argv[3]));
+			fileArg = 4;
+		}
+
+		if (argc != fileArg + 1)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		if (!fileExists(argv[fileArg]))
+		{
+			std::cerr << "Error: Cannot find file " << argv[fileArg] << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return validateFile(argv[fileArg], threads) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "split")
+	{
+		unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+		int firstArg = 2;
+		if (argc > 3 && std::string(argv[2]) == "--threads")
+		{
+			threads = std::max(1, std::atoi(argv[3]));
+			firstArg = 4;
+		}
+
+		std::string mode = argc > firstArg + 2 ? argv[firstArg + 2] : "";
+		std::string field = mode == "field" && argc == firstArg + 4 ? argv[firstArg + 3] : "";
+		bool validMode = ((mode == "storey" || mode == "building") && argc == firstArg + 3) || field.size();
+		if (!validMode)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		if (!fileExists(argv[firstArg]))
+		{
+			std::cerr << "Error: Cannot find file " << argv[firstArg] << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return splitIFC(argv[firstArg], argv[firstArg + 1], mode, field, threads) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "library")
+	{
+		if (argc != 3)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		if (!fileExists(argv[2]))
+		{
+			std::cerr << "Error: Cannot find file " << argv[2] << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return buildMaterialLibrary(argv[2], materialLibraryCache(argv[2])) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	Options options;
+	std::vector<std::string> args;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--delta")
+		{
+			options.delta = true;
+		}
+		else if (arg == "--renumber")
+		{
+			options.renumber = true;
+		}
+		else if (arg == "--pipeline")
+		{
+			options.pipeline = true;
+		}
+		else if (arg == "--validate")
+		{
+			options.validate = true;
+		}
+		else if (arg == "--threads" && i + 1 < argc)
+		{
+			options.threads = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--memory-limit" && i + 1 < argc)
+		{
+			options.memoryLimit = parseSize(argv[++i]);
+			if (!options.memoryLimit)
+			{
+				std::cerr << "Error: Invalid memory limit " << argv[i] << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--progress-fd" && i + 1 < argc)
+		{
+			setProgressOutput(std::atoi(argv[++i]));
+		}
+		else if (arg == "--precision" && i + 1 < argc)
+		{
+			options.precision = std::strtod(argv[++i], nullptr);
+			if (!(options.precision > 0))
+			{
+				std::cerr << "Error: Invalid precision " << argv[i] << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--material-library" && i + 1 < argc)
+		{
+			options.materialLibrary = argv[++i];
+		}
+		else if (!arg.compare(0, 2, "--"))
+		{
+			std::cerr << "Error: Unknown option " << arg << std::endl;
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		else
+		{
+			args.push_back(arg);
+		}
+	}
+
+	if (args.size() < 3 || args.size() % 2 == 0)
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (options.delta && options.renumber)
+	{
+		std::cerr << "Error: --delta and --renumber cannot be used together, a delta refers to the ids of the input file" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (options.renumber && options.memoryLimit)
+	{
+		std::cerr << "Error: --renumber cannot be used with --memory-limit, renumbering indexes the whole output in memory" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (options.precision && (options.delta || options.memoryLimit))
 	{
-		std::cerr << "Usage: " << argv[0] << " <input file> <output file> <csv file>" << std::endl;
+		std::cerr << "Error: --precision cannot be used with --delta or --memory-limit, as these copy entities from the input file as they are" << std::endl;
 		return EXIT_FAILURE;
 	}
 
-	std::string inputFile = argv[1];
-	std::string outputFile = argv[2];
-	std::string csvFile = argv[3];
+	if (options.delta && options.validate)
+	{
+		std::cerr << "Warning: deltas cannot be validated on their own, run validate on the applied file instead" << std::endl;
+		options.validate = false;
+	}
+
+	std::string inputFile = args[0];
+	std::vector<std::pair<std::string, std::string>> outputs;
+	for (size_t i = 1; i + 1 < args.size(); i += 2)
+		outputs.push_back({ args[i], args[i + 1] });
 
 	//Check input file exists
 	if (!fileExists(inputFile))
@@ -883,14 +1871,23 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
-	//Check csv file exists
-	if (!fileExists(csvFile))
+	//Check csv files exist
+	for (const auto &output : outputs)
 	{
-		std::cerr << "Error: Cannot find file " << csvFile << std::endl;
-		return EXIT_FAILURE;
+		if (!fileExists(output.second))
+		{
+			std::cerr << "Error: Cannot find file " << output.second << std::endl;
+			return EXIT_FAILURE;
+		}
 	}
 
-	processIFC(inputFile, outputFile, csvFile);
+	bool success = processIFC(inputFile, outputs, options);
+
+	if (cancelled())
+	{
+		std::cerr << "Cancelled, incomplete output files have been removed" << std::endl;
+		return EXIT_FAILURE;
+	}
 
-	return EXIT_SUCCESS;
-}
\ No newline at end of file
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
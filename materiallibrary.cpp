@@ -0,0 +1,345 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "materiallibrary.h"
+#include "progress.h"
+#include "step.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+static const uint64_t NO_OFFSET = std::numeric_limits<uint64_t>::max();
+
+//Bumped whenever the layout of the cache changes
+static const char CACHE_MAGIC[8] = { 'I', 'F', 'C', 'M', 'L', 'I', 'B', '1' };
+
+/**
+* The cache is laid out as the header, the entries sorted by name, then the text they point to.
+* Every field is 64 bits wide so the file can be used in place once mapped. It is written in
+* the byte order of the machine, and is simply rebuilt if it cannot be read.
+*/
+struct CacheHeader
+{
+	char     magic[8];
+	uint64_t librarySize;  //size and modification time of the library the cache was built from
+	int64_t  libraryTime;
+	uint64_t entryCount;
+	uint64_t headerOffset; //header of the library file, up to and including DATA;
+	uint64_t headerLength;
+};
+
+struct CacheEntry
+{
+	uint64_t nameOffset;
+	uint64_t nameLength;
+	uint64_t textOffset;   //records of the entry, renumbered from #1
+	uint64_t textLength;
+};
+
+/**
+* @param file file to look at
+* @param size size of the file
+* @param time last modification time of the file
+* @return returns false if the file cannot be found
+*/
+static bool getFileStamp(const std::string &file, uint64_t &size, int64_t &time)
+{
+	struct stat info;
+	if (stat(file.c_str(), &info))
+		return false;
+	size = info.st_size;
+	time = info.st_mtime;
+	return true;
+}
+
+/**
+* Replace a file with another in a single step, so the file is always either the old or the new one
+* @param from file to move
+* @param to file to replace
+* @return returns true upon success
+*/
+static bool replaceFile(const std::string &from, const std::string &to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return !std::rename(from.c_str(), to.c_str());
+#endif
+}
+
+bool buildMaterialLibrary(const std::string &libraryFile, const std::string &cacheFile)
+{
+	uint64_t librarySize;
+	int64_t libraryTime;
+	StepFile file;
+	if (!getFileStamp(libraryFile, librarySize, libraryTime) || !file.open(libraryFile))
+	{
+		std::cerr << "Failed to open material library " << libraryFile << std::endl;
+		return false;
+	}
+
+	//The IfcMaterial and IfcSurfaceStyle of each name, the first one found wins
+	std::map<std::string, std::pair<unsigned, unsigned>> materials;
+	std::vector<uint64_t> offsets;
+	std::vector<StepArgument> args;
+	std::string name;
+	StepRecord record;
+	size_t records = 0;
+	size_t unreadable = 0;
+	Progress indexProgress("index", libraryFile, file.fileSize());
+	while (file.next(record))
+	{
+		if (record.id >= offsets.size())
+			offsets.resize(std::max<size_t>(record.id + 1, offsets.size() * 2), NO_OFFSET);
+		offsets[record.id] = file.offsetOf(record);
+
+		bool isMaterial = record.isType("IFCMATERIAL");
+		if (isMaterial || record.isType("IFCSURFACESTYLE"))
+		{
+			splitArguments(record, args);
+			if (args.size() && decodeString(args[0], name))
+			{
+				auto &ids = materials[name];
+				auto &id = isMaterial ? ids.first : ids.second;
+				if (!id)
+					id = record.id;
+			}
+			else if (isMaterial || (args.size() && *args[0].first != '$'))
+			{
+				++unreadable;
+			}
+		}
+
+		if (!indexProgress.update(++records, file.position()))
+			return false;
+	}
+	indexProgress.finish();
+
+	if (unreadable)
+		std::cerr << unreadable << " materials or surface styles of " << libraryFile << " have names that cannot be read and were left out" << std::endl;
+
+	std::vector<CacheEntry> entries;
+	std::string names;
+	std::string text;
+	std::vector<unsigned> closure;
+	std::vector<unsigned> refs;
+	std::unordered_map<unsigned, unsigned> newIds;
+	auto newId = [&](const unsigned &id)
+	{
+		auto it = newIds.find(id);
+		return it == newIds.end() ? 0 : it->second;
+	};
+	for (const auto &material : materials)
+	{
+		//Everything the style references (renderings, colours, textures...) comes along with it
+		closure.clear();
+		newIds.clear();
+		for (const auto &root : { material.second.first, material.second.second })
+		{
+			if (root && newIds.emplace(root, unsigned(newIds.size() + 1)).second)
+				closure.push_back(root);
+		}
+		for (size_t i = 0; i < closure.size(); ++i)
+		{
+			file.readAt(offsets[closure[i]], record);
+			refs.clear();
+			collectReferences(record, refs);
+			for (const auto &ref : refs)
+			{
+				if (ref < offsets.size() && offsets[ref] != NO_OFFSET && newIds.emplace(ref, unsigned(newIds.size() + 1)).second)
+					closure.push_back(ref);
+			}
+		}
+
+		CacheEntry entry;
+		entry.nameOffset = names.size();
+		entry.nameLength = material.first.size();
+		entry.textOffset = text.size();
+		names += material.first;
+		for (const auto &id : closure)
+		{
+			file.readAt(offsets[id], record);
+			appendRenumbered(text, record, newId);
+		}
+		entry.textLength = text.size() - entry.textOffset;
+		entries.push_back(entry);
+	}
+
+	auto libraryHeader = file.header();
+	CacheHeader header;
+	std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.librarySize = librarySize;
+	header.libraryTime = libraryTime;
+	header.entryCount = entries.size();
+	header.headerOffset = sizeof(CacheHeader) + entries.size() * sizeof(CacheEntry);
+	header.headerLength = libraryHeader.size();
+
+	auto namesOffset = header.headerOffset + header.headerLength;
+	auto textOffset = namesOffset + names.size();
+	for (auto &entry : entries)
+	{
+		entry.nameOffset += namesOffset;
+		entry.textOffset += textOffset;
+	}
+
+	//Written aside and moved into place, so a concurrent run never maps half a cache. Runs that
+	//find the cache stale at the same time each write their own copy, and the last one to finish wins.
+#ifdef _WIN32
+	auto tempFile = cacheFile + "." + std::to_string(_getpid()) + ".tmp";
+#else
+	auto tempFile = cacheFile + "." + std::to_string(getpid()) + ".tmp";
+#endif
+	{
+		std::ofstream os(tempFile, std::ios::binary);
+		os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if (entries.size())
+			os.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(CacheEntry));
+		os << libraryHeader << names << text;
+		if (!os)
+		{
+			std::cerr << "Failed to write the material library cache " << tempFile << std::endl;
+			os.close();
+			std::remove(tempFile.c_str());
+			return false;
+		}
+	}
+
+	if (!replaceFile(tempFile, cacheFile))
+	{
+		std::cerr << "Failed to move the material library cache into " << cacheFile << std::endl;
+		std::remove(tempFile.c_str());
+		return false;
+	}
+
+	std::cout << "Indexed " << entries.size() << " materials of " << libraryFile << " into " << cacheFile << std::endl;
+	return true;
+}
+
+bool MaterialLibrary::map(const std::string &libraryFile)
+{
+	uint64_t librarySize;
+	int64_t libraryTime;
+	if (!getFileStamp(libraryFile, librarySize, libraryTime))
+		return false;
+
+	try
+	{
+		mapping = boost::interprocess::file_mapping(materialLibraryCache(libraryFile).c_str(), boost::interprocess::read_only);
+		region = boost::interprocess::mapped_region(mapping, boost::interprocess::read_only);
+	}
+	catch (const boost::interprocess::interprocess_exception &)
+	{
+		return false;
+	}
+
+	data = static_cast<const char*>(region.get_address());
+	auto size = region.get_size();
+	header = reinterpret_cast<const CacheHeader*>(data);
+	entries = reinterpret_cast<const CacheEntry*>(data + sizeof(CacheHeader));
+	if (size < sizeof(CacheHeader)
+		|| std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC))
+		|| header->librarySize != librarySize
+		|| header->libraryTime != libraryTime
+		|| header->entryCount > (size - sizeof(CacheHeader)) / sizeof(CacheEntry)
+		|| header->headerOffset > size
+		|| header->headerLength > size - header->headerOffset)
+	{
+		header = nullptr;
+		return false;
+	}
+
+	for (uint64_t i = 0; i < header->entryCount; ++i)
+	{
+		const auto &entry = entries[i];
+		if (entry.nameOffset > size || entry.nameLength > size - entry.nameOffset
+			|| entry.textOffset > size || entry.textLength > size - entry.textOffset)
+		{
+			header = nullptr;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MaterialLibrary::open(const std::string &libraryFile)
+{
+	if (map(libraryFile))
+		return true;
+
+	//The mapping has to be let go of before the cache can be replaced on Windows
+	region = boost::interprocess::mapped_region();
+	mapping = boost::interprocess::file_mapping();
+	if (!buildMaterialLibrary(libraryFile, materialLibraryCache(libraryFile)))
+		return false;
+
+	if (!map(libraryFile))
+	{
+		std::cerr << "Failed to read the material library cache " << materialLibraryCache(libraryFile) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+std::string MaterialLibrary::find(const std::string &name) const
+{
+	if (!header)
+		return std::string();
+
+	//The entries are sorted by name
+	size_t first = 0;
+	size_t last = header->entryCount;
+	while (first < last)
+	{
+		auto middle = first + (last - first) / 2;
+		const auto &entry = entries[middle];
+		auto order = name.compare(0, std::string::npos, data + entry.nameOffset, entry.nameLength);
+		if (!order)
+		{
+			std::string file(data + header->headerOffset, header->headerLength);
+			file += '\n';
+			file.append(data + entry.textOffset, entry.textLength);
+			file += "ENDSEC;\nEND-ISO-10303-21;\n";
+			return file;
+		}
+		if (order < 0)
+			last = middle;
+		else
+			first = middle + 1;
+	}
+	return std::string();
+}
+
+size_t MaterialLibrary::size() const
+{
+	return header ? header->entryCount : 0;
+}
@@ -0,0 +1,84 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <string>
+
+struct CacheHeader;
+struct CacheEntry;
+
+/**
+* Index the materials and surface styles of a library IFC file into a cache that can be
+* memory mapped, so they can be looked up without parsing the library again. Each entry
+* holds the IfcMaterial and/or the IfcSurfaceStyle of a name, along with everything the
+* style references, renumbered into a standalone set of records.
+* @param libraryFile library IFC file
+* @param cacheFile location to write the cache to
+* @return returns true upon success
+*/
+bool buildMaterialLibrary(const std::string &libraryFile, const std::string &cacheFile);
+
+/**
+* @param libraryFile library IFC file
+* @return returns the location of the cache of the library
+*/
+inline std::string materialLibraryCache(const std::string &libraryFile) { return libraryFile + ".matcache"; }
+
+/**
+* A material library, read from its memory mapped cache
+*/
+class MaterialLibrary
+{
+public:
+	/**
+	* Map the cache of the given library, building it first if it is missing or
+	* older than the library
+	* @param libraryFile library IFC file
+	* @return returns true upon success
+	*/
+	bool open(const std::string &libraryFile);
+
+	/**
+	* Look up a material by name
+	* @param name name of the IfcMaterial or IfcSurfaceStyle
+	* @return returns a standalone IFC file holding the material and its surface style, empty if there is no such material
+	*/
+	std::string find(const std::string &name) const;
+
+	/**
+	* @return returns the number of materials within the library
+	*/
+	size_t size() const;
+
+private:
+	/**
+	* Map the cache and check it is valid and up to date
+	* @param libraryFile library IFC file
+	* @return returns true if the cache can be used
+	*/
+	bool map(const std::string &libraryFile);
+
+	boost::interprocess::file_mapping  mapping;
+	boost::interprocess::mapped_region region;
+	const char        *data = nullptr;
+	const CacheHeader *header = nullptr;
+	const CacheEntry  *entries = nullptr;
+};
@@ -0,0 +1,102 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "numeric.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+//Most decimals written for a rounded value, finer steps than this are not worth rounding to
+static const int MAX_DECIMALS = 17;
+
+RealFormat::RealFormat(const double &quantum) : quantum(0), decimals(0)
+{
+	//A step in model units is rarely a power of ten (e.g. 0.0001m in feet), and multiples of it
+	//would need as many decimals as the step itself. Snap it down to the power of ten below, so
+	//values are rounded at least as finely as asked with few decimals.
+	if (quantum > 0)
+	{
+		auto exponent = int(std::floor(std::log10(quantum) + 1e-9));
+		decimals = std::min(std::max(-exponent, 0), MAX_DECIMALS);
+		this->quantum = std::pow(10.0, std::max(exponent, -MAX_DECIMALS));
+	}
+}
+
+void RealFormat::append(std::string &out, const double &value) const
+{
+	//Fixed notation is only used below 1e15: sign, 15 digits, point and the decimals
+	char buffer[64];
+	int length;
+	auto rounded = quantum > 0 ? std::round(value / quantum) * quantum : value;
+
+	if (!std::isfinite(rounded))
+	{
+		length = std::snprintf(buffer, sizeof(buffer), "%.17g", rounded);
+	}
+	else if (rounded == std::trunc(rounded) && std::abs(rounded) < 1e15)
+	{
+		//Whole numbers are common (0., 1.), skip the round trip
+		length = std::snprintf(buffer, sizeof(buffer), "%.0f", rounded == 0 ? 0.0 : rounded);
+	}
+	else if (quantum > 0 && std::abs(rounded) < 1e15)
+	{
+		length = std::snprintf(buffer, sizeof(buffer), "%.*f", decimals, rounded);
+		while (buffer[length - 1] == '0') --length;
+		if (buffer[length - 1] == '.') --length;
+	}
+	else
+	{
+		//15 significant digits always read back as written, so if they read back
+		//as the value, no shorter representation does. Otherwise add digits until one does.
+		for (int precision = 15; precision <= 17; ++precision)
+		{
+			length = std::snprintf(buffer, sizeof(buffer), "%.*g", precision, rounded);
+			if (std::strtod(buffer, nullptr) == rounded)
+				break;
+		}
+	}
+
+	//STEP reals need a decimal point in the mantissa, and an upper case exponent
+	auto exponent = std::find(buffer, buffer + length, 'e');
+	auto point = std::find(buffer, exponent, '.');
+	out.append(buffer, exponent);
+	if (point == exponent)
+		out += '.';
+	if (exponent != buffer + length)
+	{
+		out += 'E';
+		out.append(exponent + 1, buffer + length);
+	}
+}
+
+void RealFormat::appendEntity(std::string &out, const unsigned &id, const char *type, const std::vector<double> &values) const
+{
+	out += '#';
+	out += std::to_string(id);
+	out += '=';
+	out += type;
+	out += "((";
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		if (i) out += ',';
+		append(out, values[i]);
+	}
+	out += "))";
+}
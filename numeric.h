@@ -0,0 +1,57 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+* Formatting of reals in STEP syntax, e.g. 1., -0.25 or 1.5E-05
+*/
+class RealFormat
+{
+public:
+	/**
+	* @param quantum step to round values to, 0 writes every value exactly. Steps that are not a
+	* power of ten are snapped down to the power of ten below them, e.g. 0.00032 to 0.0001.
+	*/
+	explicit RealFormat(const double &quantum = 0);
+
+	/**
+	* Append a value to the given text. Exact values are written with the fewest
+	* significant digits that read back as the same double, rounded values with
+	* only the decimals the step needs.
+	* @param out text to append to
+	* @param value value to append
+	*/
+	void append(std::string &out, const double &value) const;
+
+	/**
+	* Append an entity whose only argument is a list of reals, such as an
+	* IfcCartesianPoint or an IfcDirection, without the terminating ';'
+	* @param out text to append to
+	* @param id id of the entity
+	* @param type upper case name of the type, e.g. "IFCCARTESIANPOINT"
+	* @param values the list of reals
+	*/
+	void appendEntity(std::string &out, const unsigned &id, const char *type, const std::vector<double> &values) const;
+
+private:
+	double quantum;
+	int    decimals;
+};
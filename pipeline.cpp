@@ -0,0 +1,67 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pipeline.h"
+
+const size_t ShardWriter::SHARD_SIZE;
+const size_t ShardWriter::DEPTH;
+
+ShardWriter::ShardWriter(const std::string &file)
+	: os(file, std::ios::binary), queue(DEPTH)
+{
+	current.reserve(SHARD_SIZE);
+	writer = std::thread([this]()
+	{
+		std::string shard;
+		while (queue.pop(shard))
+			os.write(shard.data(), shard.size());
+	});
+}
+
+ShardWriter::~ShardWriter()
+{
+	finish();
+}
+
+bool ShardWriter::append(const char *text, const size_t &length)
+{
+	if (finished)
+		return false;
+
+	current.append(text, length);
+	if (current.size() >= SHARD_SIZE)
+	{
+		write(std::move(current));
+		current = std::string();
+		current.reserve(SHARD_SIZE);
+	}
+	return true;
+}
+
+bool ShardWriter::finish()
+{
+	if (!finished)
+	{
+		if (current.size())
+			write(std::move(current));
+		finished = true;
+		queue.close();
+		writer.join();
+		os.close();
+	}
+	return !os.fail();
+}
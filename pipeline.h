@@ -0,0 +1,152 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+* Wait a little longer each time a pipeline stage finds nothing to do
+* @param spins number of times the caller has waited so far
+*/
+inline void backoff(unsigned &spins)
+{
+	if (++spins < 64)
+		std::this_thread::yield();
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+/**
+* A bounded, lock-free queue between a single producer and a single consumer.
+* The producer waits while the queue is full, which caps the memory held
+* between two stages of a pipeline.
+*/
+template <typename T>
+class BoundedQueue
+{
+public:
+	/**
+	* @param capacity maximum number of items held in the queue
+	*/
+	explicit BoundedQueue(const size_t &capacity) : slots(capacity + 1) {}
+
+	/**
+	* Push an item, waiting for space if the queue is full
+	* @param item item to push
+	* @return returns false if the queue is closed, the item is then dropped
+	*/
+	bool push(T item)
+	{
+		//once closed, the consumer may be gone and would never make room
+		if (closed.load(std::memory_order_acquire))
+			return false;
+
+		auto tail = tailPos.load(std::memory_order_relaxed);
+		auto next = (tail + 1) % slots.size();
+		unsigned spins = 0;
+		while (next == headPos.load(std::memory_order_acquire))
+			backoff(spins);
+
+		slots[tail] = std::move(item);
+		tailPos.store(next, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	* Signal the consumer that no more items will be pushed
+	*/
+	void close() { closed.store(true, std::memory_order_release); }
+
+	/**
+	* Pop an item, waiting for one if the queue is empty
+	* @param item item to populate
+	* @return returns false once the queue is closed and drained
+	*/
+	bool pop(T &item)
+	{
+		auto head = headPos.load(std::memory_order_relaxed);
+		unsigned spins = 0;
+		while (head == tailPos.load(std::memory_order_acquire))
+		{
+			//check the queue once more after seeing it closed, items may have been pushed just before
+			if (closed.load(std::memory_order_acquire) && head == tailPos.load(std::memory_order_acquire))
+				return false;
+			backoff(spins);
+		}
+
+		item = std::move(slots[head]);
+		headPos.store((head + 1) % slots.size(), std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::vector<T>      slots;
+	std::atomic<size_t> headPos{ 0 };
+	std::atomic<size_t> tailPos{ 0 };
+	std::atomic<bool>   closed{ false };
+};
+
+/**
+* Writes shards of text to a file on its own thread, so the next shard can be
+* formatted while the previous one is being written
+*/
+class ShardWriter
+{
+public:
+	static const size_t SHARD_SIZE = 4 << 20;
+	static const size_t DEPTH = 8;
+
+	/**
+	* @param file location of the file to write
+	*/
+	explicit ShardWriter(const std::string &file);
+	~ShardWriter();
+
+	/**
+	* Queue a shard to be written, waits if too many shards are pending
+	* @param shard text to write
+	* @return returns false if the writer is already finished, the shard is then dropped
+	*/
+	bool write(std::string shard) { return !finished && queue.push(std::move(shard)); }
+
+	/**
+	* Append text to the current shard, queuing it once it is large enough
+	* @param text text to append
+	* @return returns false if the writer is already finished, the text is then dropped
+	*/
+	bool append(const char *text, const size_t &length);
+	bool append(const std::string &text) { return append(text.data(), text.size()); }
+
+	/**
+	* Write out the remaining shards and close the file
+	* @return returns true if everything was written successfully
+	*/
+	bool finish();
+
+private:
+	std::ofstream             os;
+	BoundedQueue<std::string> queue;
+	std::string               current;
+	std::thread               writer;
+	bool                      finished = false;
+};
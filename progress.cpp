@@ -0,0 +1,188 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "progress.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const int64_t REPORT_INTERVAL_MS = 1000;
+
+static int progressFd = 2;
+static volatile std::sig_atomic_t cancelRequested = 0;
+
+void setProgressOutput(const int &fd)
+{
+	progressFd = fd;
+}
+
+/**
+* Signal handler, only flags the request so the run can wind down by itself
+*/
+static void onSignal(int)
+{
+	cancelRequested = 1;
+}
+
+void installCancellationHandler()
+{
+#ifdef _WIN32
+	//the handler is reset to the default upon delivery on Windows
+	std::signal(SIGINT, onSignal);
+	std::signal(SIGTERM, onSignal);
+#else
+	//Without SA_RESTART, blocking calls such as wait() return upon the signal
+	struct sigaction action = {};
+	action.sa_handler = onSignal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+#endif
+}
+
+bool cancelled()
+{
+	return cancelRequested != 0;
+}
+
+Progress::Progress(const std::string &phase, const std::string &file, const uint64_t &totalBytes, const uint64_t &totalEntities)
+	: phase(phase), file(file), totalBytes(totalBytes), totalEntities(totalEntities), start(std::chrono::steady_clock::now())
+{
+	//announce the start of the phase straight away
+	lastReport = -REPORT_INTERVAL_MS;
+	report(false);
+}
+
+bool Progress::add(const uint64_t &entityCount, const uint64_t &byteCount)
+{
+	auto doneEntities = entities.fetch_add(entityCount, std::memory_order_relaxed) + entityCount;
+	auto doneBytes = bytes.fetch_add(byteCount, std::memory_order_relaxed) + byteCount;
+
+	//Only look at the clock every 4096 entities or every MB
+	if ((doneEntities - entityCount) >> 12 != doneEntities >> 12 || (doneBytes - byteCount) >> 20 != doneBytes >> 20)
+		report(false);
+	return !cancelled();
+}
+
+bool Progress::update(const uint64_t &entityCount, const uint64_t &byteCount)
+{
+	auto previousEntities = entities.exchange(entityCount, std::memory_order_relaxed);
+	auto previousBytes = bytes.exchange(byteCount, std::memory_order_relaxed);
+
+	if (previousEntities >> 12 != entityCount >> 12 || previousBytes >> 20 != byteCount >> 20)
+		report(false);
+	return !cancelled();
+}
+
+void Progress::finish()
+{
+	report(true);
+}
+
+void Progress::report(const bool &done)
+{
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	if (!done)
+	{
+		//only one thread reports at a time, and no more than once per interval
+		auto last = lastReport.load();
+		if (elapsed - last < REPORT_INTERVAL_MS || !lastReport.compare_exchange_strong(last, elapsed))
+			return;
+	}
+
+	auto doneEntities = entities.load(std::memory_order_relaxed);
+	auto doneBytes = bytes.load(std::memory_order_relaxed);
+	auto seconds = std::max<int64_t>(elapsed, 1) / 1000.0;
+	auto megabytes = doneBytes / double(1 << 20);
+
+	char line[512];
+	auto length = std::snprintf(line, sizeof(line), "progress phase=%s file=%s%s entities=%llu",
+		phase.c_str(), file.c_str(), done ? " done" : "", (unsigned long long)doneEntities);
+	auto append = [&](const char *format, const double &value)
+	{
+		if (length > 0 && length < int(sizeof(line)))
+			length += std::snprintf(line + length, sizeof(line) - length, format, value);
+	};
+
+	if (doneBytes)
+	{
+		append(" MB=%.1f", megabytes);
+		append(" MB/s=%.1f", megabytes / seconds);
+	}
+	else
+	{
+		append(" entities/s=%.0f", doneEntities / seconds);
+	}
+
+	//The fraction of the work done, measured in bytes where possible
+	double fraction = -1;
+	if (totalBytes && doneBytes)
+		fraction = double(doneBytes) / totalBytes;
+	else if (totalEntities)
+		fraction = double(doneEntities) / totalEntities;
+
+	if (done)
+	{
+		append(" seconds=%.1f", seconds);
+	}
+	else if (fraction >= 0)
+	{
+		append(" percent=%.1f", 100 * fraction);
+		if (fraction > 0)
+			append(" eta=%.0fs", seconds * (1 - fraction) / fraction);
+	}
+
+	if (length <= 0 || length >= int(sizeof(line)))
+		return;
+	line[length++] = '\n';
+
+	//a single write per event, so events from several threads or processes do not interleave
+#ifdef _WIN32
+	auto written = _write(progressFd, line, length);
+#else
+	auto written = write(progressFd, line, length);
+#endif
+	(void)written;
+}
+
+void Counters::report(std::ostream &os, const std::string &title) const
+{
+	if (counts.empty())
+		return;
+
+	//Listed by description rather than by address
+	std::vector<std::pair<std::string, size_t>> lines;
+	for (const auto &event : counts)
+	{
+		for (const auto &detail : event.second)
+			lines.push_back({ detail.first.empty() ? event.first : event.first + (" " + detail.first), detail.second });
+	}
+	std::sort(lines.begin(), lines.end());
+
+	os << title << std::endl;
+	for (const auto &line : lines)
+		os << "\t" << line.first << ": " << line.second << std::endl;
+}
@@ -0,0 +1,128 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+
+/**
+* Send progress events to the given file descriptor instead of stderr
+* @param fd file descriptor to write to
+*/
+void setProgressOutput(const int &fd);
+
+/**
+* Handle SIGINT and SIGTERM by asking the run to stop. Long running loops notice
+* through Progress::add/update, stop, and remove the output they were writing.
+* A second signal terminates the program straight away.
+*/
+void installCancellationHandler();
+
+/**
+* @return returns true once the run has been asked to stop
+*/
+bool cancelled();
+
+/**
+* Rate limited progress events for a phase of the run, one line each:
+* progress phase=<phase> file=<file> entities=<n> MB=<n> percent=<n> MB/s=<n> eta=<n>s
+* The percentage and ETA are given when the total amount of work is known.
+*/
+class Progress
+{
+public:
+	/**
+	* @param phase name of the phase, e.g. "parse"
+	* @param file file being processed
+	* @param totalBytes number of bytes to process, 0 if unknown
+	* @param totalEntities number of entities to process, 0 if unknown
+	*/
+	Progress(const std::string &phase, const std::string &file, const uint64_t &totalBytes, const uint64_t &totalEntities = 0);
+
+	/**
+	* Account for work done, may be called from several threads
+	* @param entities number of entities processed
+	* @param bytes number of bytes processed
+	* @return returns false if the run has been cancelled
+	*/
+	bool add(const uint64_t &entities, const uint64_t &bytes = 0);
+
+	/**
+	* Set the amount of work done so far, from a single thread
+	* @param entities number of entities processed
+	* @param bytes number of bytes processed
+	* @return returns false if the run has been cancelled
+	*/
+	bool update(const uint64_t &entities, const uint64_t &bytes = 0);
+
+	/**
+	* Report the completion of the phase, with its overall throughput
+	*/
+	void finish();
+
+private:
+	/**
+	* Report progress if the last report is old enough
+	* @param done whether the phase is complete
+	*/
+	void report(const bool &done);
+
+	std::string phase;
+	std::string file;
+	uint64_t    totalBytes;
+	uint64_t    totalEntities;
+	std::chrono::steady_clock::time_point start;
+	std::atomic<uint64_t> entities{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+	std::atomic<int64_t>  lastReport{ 0 }; //in milliseconds since start
+};
+
+/**
+* Number of occurrences of events that are summarised rather than reported one line
+* each, such as properties without a value. Not thread safe.
+*/
+class Counters
+{
+public:
+	/**
+	* @param event description of the event, a string literal. Events are told apart by address.
+	* @param count number of occurrences to add
+	*/
+	void add(const char *event, const size_t &count = 1) { counts[event][std::string()] += count; }
+
+	/**
+	* @param event description of the event, a string literal. Events are told apart by address.
+	* @param detail what these occurrences are about, e.g. the name of a material, counted apart
+	* @param count number of occurrences to add
+	*/
+	void add(const char *event, const std::string &detail, const size_t &count = 1) { counts[event][detail] += count; }
+
+	/**
+	* Print every event with its number of occurrences
+	* @param os stream to print to
+	* @param title line printed before the events, if there are any
+	*/
+	void report(std::ostream &os, const std::string &title) const;
+
+private:
+	std::map<const char*, std::map<std::string, size_t>> counts; //by event, then by detail
+};
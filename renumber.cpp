@@ -0,0 +1,127 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "renumber.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "step.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+bool renumberFile(const std::string &inputFile, const std::string &outputFile)
+{
+	StepFile file;
+	if (!file.open(inputFile))
+		return false;
+
+	StepGraph graph;
+	if (!readGraph(file, inputFile, "renumber", graph))
+		return false;
+	const auto &records = graph.records;
+	const auto &refStart = graph.refStart;
+	const auto &refs = graph.refs;
+
+	std::vector<bool> referenced(records.size(), false);
+	for (const auto &ref : refs)
+	{
+		if (ref != NOT_FOUND)
+			referenced[ref] = true;
+	}
+
+	if (graph.dangling)
+		std::cerr << "Warning: " << graph.dangling << " references to missing entities in " << inputFile << std::endl;
+
+	//Depth first post-order from the roots, so referenced entities precede their users.
+	//Anything left unvisited afterwards is only reachable through cycles.
+	std::vector<unsigned> order;
+	order.reserve(records.size());
+	std::vector<bool> visited(records.size(), false);
+	std::vector<std::pair<unsigned, unsigned>> stack;
+
+	auto visit = [&](const unsigned &root)
+	{
+		if (visited[root]) return;
+		visited[root] = true;
+		stack.push_back({ root, refStart[root] });
+		while (stack.size())
+		{
+			auto &top = stack.back();
+			if (top.second < refStart[top.first + 1])
+			{
+				auto child = refs[top.second++];
+				if (child != NOT_FOUND && !visited[child])
+				{
+					visited[child] = true;
+					stack.push_back({ child, refStart[child] });
+				}
+			}
+			else
+			{
+				order.push_back(top.first);
+				stack.pop_back();
+			}
+		}
+	};
+
+	for (unsigned i = 0; i < records.size(); ++i)
+	{
+		if (!referenced[i])
+			visit(i);
+	}
+	for (unsigned i = 0; i < records.size(); ++i)
+		visit(i);
+
+	std::vector<unsigned> newIds(records.size());
+	for (unsigned i = 0; i < order.size(); ++i)
+		newIds[order[i]] = i + 1;
+
+	auto newId = [&](const unsigned &id)
+	{
+		auto index = graph.indexOf(id);
+		return index == NOT_FOUND ? 0 : newIds[index];
+	};
+
+	Progress writeProgress("write", outputFile, 0, order.size());
+	ShardWriter writer(outputFile);
+	writer.append(file.header() + "\n");
+	std::string text;
+	for (const auto &index : order)
+	{
+		if (!writeProgress.add(1, records[index].end - records[index].begin))
+		{
+			writer.finish();
+			std::remove(outputFile.c_str());
+			return false;
+		}
+		text.clear();
+		appendRenumbered(text, records[index], newId);
+		writer.append(text);
+	}
+	writer.append(file.trailer());
+	writeProgress.finish();
+
+	if (!writer.finish())
+	{
+		std::cerr << "Failed to write " << outputFile << std::endl;
+		return false;
+	}
+
+	return true;
+}
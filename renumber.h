@@ -0,0 +1,30 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+
+/**
+* Rewrite an IFC file with dense entity ids, ordered so that every entity is
+* placed right after the entities it references (a depth first post-order from
+* the entities nothing refers to). All references are rewritten accordingly.
+* @param inputFile IFC file to renumber
+* @param outputFile location to write the renumbered file to
+* @return returns true upon success
+*/
+bool renumberFile(const std::string &inputFile, const std::string &outputFile);
@@ -0,0 +1,401 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "splitter.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "step.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <thread>
+
+/**
+* A record that nothing references, but which belongs with the entities it references:
+* relationships, styled items, material representations and layer assignments.
+* Its references are stored with the single references first, then those within lists.
+*/
+struct Attachment
+{
+	unsigned record;    //index of the record
+	unsigned anchor;    //index of the entity that brings in the whole record, NOT_FOUND if none
+	unsigned listBegin; //start of the references within lists
+	bool     byList;    //whether the record is also brought in by its list members, with the lists filtered
+};
+
+enum Inclusion : uint8_t { EXCLUDED, WHOLE, FILTERED };
+
+/**
+* Find out if a record is an attachment, and which argument anchors it
+* @param record record to examine
+* @param anchorArg argument holding the anchor, -1 if none
+* @param byList whether the record is brought in by its list members
+* @return returns true if the record is an attachment
+*/
+static bool isAttachment(const StepRecord &record, int &anchorArg, bool &byList)
+{
+	if (record.typeEnd - record.typeBegin > 6 && std::equal(record.typeBegin, record.typeBegin + 6, "IFCREL",
+		[](const char &a, const char &b) { return std::toupper((unsigned char)a) == b; }))
+	{
+		//Relating object/element/structure etc, for most relationships
+		anchorArg = 4;
+		byList = true;
+		return true;
+	}
+	if (record.isType("IFCSTYLEDITEM") || record.isType("IFCANNOTATIONSURFACEOCCURRENCE"))
+	{
+		//Styles are shared by everything, only the item brings the styled item in
+		anchorArg = 0;
+		byList = false;
+		return true;
+	}
+	if (record.isType("IFCMATERIALDEFINITIONREPRESENTATION"))
+	{
+		anchorArg = 3;
+		byList = false;
+		return true;
+	}
+	if (record.isType("IFCPRESENTATIONLAYERASSIGNMENT") || record.isType("IFCPRESENTATIONLAYERWITHSTYLE"))
+	{
+		anchorArg = -1;
+		byList = true;
+		return true;
+	}
+	return false;
+}
+
+/**
+* Write an attachment with the members of its lists of references limited to the part.
+* Lists holding anything but references are written as they are.
+* @param writer writer to write to
+* @param record record to write
+* @param idToIndex map of id to record index
+* @param state inclusion of each record, by record index
+*/
+static void writeFiltered(
+	ShardWriter                  &writer,
+	const StepRecord             &record,
+	const std::vector<unsigned>  &idToIndex,
+	const std::vector<Inclusion> &state)
+{
+	std::vector<StepArgument> args;
+	splitArguments(record, args);
+
+	std::string out(record.begin, record.typeEnd);
+	out += '(';
+	for (size_t i = 0; i < args.size(); ++i)
+	{
+		if (i) out += ',';
+		const auto &arg = args[i];
+		if (arg.first == arg.second || *arg.first != '(')
+		{
+			out.append(arg.first, arg.second);
+			continue;
+		}
+
+		std::string list = "(";
+		bool refsOnly = true;
+		for (auto pos = arg.first + 1; pos < arg.second - 1 && refsOnly; ++pos)
+		{
+			if (*pos == '#')
+			{
+				unsigned id = 0;
+				while (pos + 1 < arg.second && std::isdigit((unsigned char)pos[1]))
+					id = id * 10 + (*++pos - '0');
+				if (id < idToIndex.size() && idToIndex[id] != NOT_FOUND && state[idToIndex[id]] != EXCLUDED)
+				{
+					if (list.size() > 1) list += ',';
+					list += '#';
+					list += std::to_string(id);
+				}
+			}
+			else if (*pos != ',' && !std::isspace((unsigned char)*pos))
+			{
+				refsOnly = false;
+			}
+		}
+		if (refsOnly)
+			out += list + ')';
+		else
+			out.append(arg.first, arg.second);
+	}
+	out += ");\n";
+	writer.append(out);
+}
+
+/**
+* Make up a file name for each part, replacing the characters that do not belong in one
+* @param parts parts to name
+* @param outputPrefix prefix of the files
+* @return returns the file name of each part, in the order of the parts
+*/
+static std::vector<std::string> getPartFiles(
+	const std::map<std::string, std::vector<unsigned>> &parts,
+	const std::string                                   &outputPrefix)
+{
+	std::vector<std::string> files;
+	std::set<std::string> used;
+	for (const auto &part : parts)
+	{
+		auto name = part.first;
+		for (auto &c : name)
+		{
+			if (!std::isalnum((unsigned char)c) && c != '-' && c != '_' && c != '.')
+				c = '_';
+		}
+
+		auto file = outputPrefix + "_" + name + ".ifc";
+		for (int i = 2; !used.insert(file).second; ++i)
+			file = outputPrefix + "_" + name + "_" + std::to_string(i) + ".ifc";
+		files.push_back(file);
+	}
+	return files;
+}
+
+bool splitFile(
+	const std::string                                   &inputFile,
+	const std::map<std::string, std::vector<unsigned>>  &parts,
+	const std::vector<unsigned>                         &common,
+	const std::string                                   &outputPrefix,
+	const unsigned                                      &threads)
+{
+	StepFile file;
+	if (!file.open(inputFile))
+		return false;
+
+	//Attachments are set aside as nothing references them. Their references are collected
+	//with the single references first, to tell the anchor and list members apart.
+	std::vector<Attachment> attachments;
+	std::vector<unsigned> attachmentAnchors;
+	std::vector<StepArgument> args;
+	std::vector<unsigned> listRefs;
+	StepGraph graph;
+	auto collect = [&](const unsigned &index, const StepRecord &record, std::vector<unsigned> &refs)
+	{
+		int anchorArg;
+		bool byList;
+		if (!isAttachment(record, anchorArg, byList))
+		{
+			collectReferences(record, refs);
+			return;
+		}
+
+		splitArguments(record, args);
+		listRefs.clear();
+		unsigned anchor = 0;
+		for (size_t i = 0; i < args.size(); ++i)
+		{
+			if (args[i].first < args[i].second && *args[i].first == '(')
+			{
+				collectReferences(args[i].first, args[i].second, listRefs);
+			}
+			else if (auto id = referencedId(args[i]))
+			{
+				refs.push_back(id);
+				if (int(i) == anchorArg)
+					anchor = id;
+			}
+		}
+		attachments.push_back({ index, NOT_FOUND, unsigned(refs.size()), byList });
+		attachmentAnchors.push_back(anchor);
+		refs.insert(refs.end(), listRefs.begin(), listRefs.end());
+	};
+	if (!readGraph(file, inputFile, "index", graph, collect))
+		return false;
+	const auto &records = graph.records;
+	const auto &refStart = graph.refStart;
+	const auto &refs = graph.refs;
+
+	for (size_t i = 0; i < attachments.size(); ++i)
+		attachments[i].anchor = graph.indexOf(attachmentAnchors[i]);
+
+	//Index the attachments by the entities that bring them in, flagging those brought in by their anchor
+	std::vector<unsigned> triggerStart(records.size() + 1, 0), triggers;
+	auto forEachTrigger = [&](const std::function<void(const unsigned &, const unsigned &)> &func)
+	{
+		for (unsigned i = 0; i < attachments.size(); ++i)
+		{
+			const auto &attachment = attachments[i];
+			if (attachment.anchor != NOT_FOUND)
+				func(attachment.anchor, i << 1 | 1);
+			if (!attachment.byList)
+				continue;
+			for (auto ref = attachment.listBegin; ref < refStart[attachment.record + 1]; ++ref)
+			{
+				if (refs[ref] != NOT_FOUND)
+					func(refs[ref], i << 1);
+			}
+		}
+	};
+	forEachTrigger([&](const unsigned &index, const unsigned &) { ++triggerStart[index + 1]; });
+	for (size_t i = 1; i < triggerStart.size(); ++i)
+		triggerStart[i] += triggerStart[i - 1];
+	triggers.resize(triggerStart.back());
+	{
+		auto fill = triggerStart;
+		forEachTrigger([&](const unsigned &index, const unsigned &trigger) { triggers[fill[index]++] = trigger; });
+	}
+
+	std::vector<unsigned> attachmentOf(records.size(), NOT_FOUND);
+	for (unsigned i = 0; i < attachments.size(); ++i)
+		attachmentOf[attachments[i].record] = i;
+
+	std::vector<bool> isCommon(records.size(), false);
+	std::vector<unsigned> commonIndices;
+	for (const auto &id : common)
+	{
+		auto index = graph.indexOf(id);
+		if (index == NOT_FOUND)
+		{
+			std::cerr << "Warning: entity #" << id << " not found in " << inputFile << std::endl;
+			continue;
+		}
+		isCommon[index] = true;
+		commonIndices.push_back(index);
+	}
+
+	auto files = getPartFiles(parts, outputPrefix);
+	std::vector<const std::pair<const std::string, std::vector<unsigned>>*> partList;
+	for (const auto &part : parts)
+		partList.push_back(&part);
+
+	std::vector<std::string> reports(partList.size());
+	std::atomic<size_t> nextPart(0);
+	std::atomic<bool> success(true);
+	Progress splitProgress("split", inputFile, 0, partList.size());
+
+	auto splitParts = [&]()
+	{
+		std::vector<Inclusion> state(records.size());
+		std::vector<unsigned> queue;
+		for (size_t p; (p = nextPart++) < partList.size();)
+		{
+			const auto &part = *partList[p];
+			std::fill(state.begin(), state.end(), EXCLUDED);
+			queue.clear();
+
+			auto include = [&](const unsigned &index)
+			{
+				if (index != NOT_FOUND && state[index] != WHOLE)
+				{
+					state[index] = WHOLE;
+					queue.push_back(index);
+				}
+			};
+
+			for (const auto &index : commonIndices)
+				include(index);
+			size_t missing = 0;
+			for (const auto &id : part.second)
+			{
+				auto index = graph.indexOf(id);
+				if (index == NOT_FOUND)
+					++missing;
+				include(index);
+			}
+
+			//Forward closure, bringing in the attachments of whatever is included along the way
+			while (queue.size())
+			{
+				auto index = queue.back();
+				queue.pop_back();
+
+				auto refEnd = refStart[index + 1];
+				if (attachmentOf[index] != NOT_FOUND && state[index] == FILTERED)
+					refEnd = attachments[attachmentOf[index]].listBegin;
+				for (auto ref = refStart[index]; ref < refEnd; ++ref)
+					include(refs[ref]);
+
+				for (auto t = triggerStart[index]; t < triggerStart[index + 1]; ++t)
+				{
+					const auto &attachment = attachments[triggers[t] >> 1];
+					bool byAnchor = triggers[t] & 1;
+					if (byAnchor && !isCommon[index])
+					{
+						include(attachment.record);
+					}
+					else if (!byAnchor && state[attachment.record] == EXCLUDED)
+					{
+						state[attachment.record] = FILTERED;
+						queue.push_back(attachment.record);
+					}
+				}
+			}
+
+			ShardWriter writer(files[p]);
+			writer.append(file.header() + "\n");
+			size_t count = 0;
+			for (unsigned i = 0; i < records.size() && !cancelled(); ++i)
+			{
+				if (state[i] == EXCLUDED)
+					continue;
+				++count;
+				if (state[i] == FILTERED)
+				{
+					writeFiltered(writer, records[i], graph.idToIndex, state);
+				}
+				else
+				{
+					writer.append(records[i].begin, records[i].end - records[i].begin);
+					writer.append("\n", 1);
+				}
+			}
+			writer.append(file.trailer());
+
+			bool written = writer.finish();
+
+			//a part cut short is not left behind, those completed are valid on their own
+			if (cancelled())
+			{
+				std::remove(files[p].c_str());
+				success = false;
+				break;
+			}
+			if (!written)
+			{
+				reports[p] = "Failed to write " + files[p];
+				success = false;
+				continue;
+			}
+
+			reports[p] = part.first + ": " + std::to_string(part.second.size()) + " products, "
+				+ std::to_string(count) + " entities written to " + files[p];
+			if (missing)
+				reports[p] += " (" + std::to_string(missing) + " products not found)";
+			splitProgress.add(1);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < std::min<size_t>(std::max(1u, threads), partList.size()); ++i)
+		workers.push_back(std::thread(splitParts));
+	splitParts();
+	for (auto &worker : workers)
+		worker.join();
+	splitProgress.finish();
+
+	for (const auto &report : reports)
+		std::cout << report << std::endl;
+
+	return success;
+}
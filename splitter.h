@@ -0,0 +1,43 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+* Split an IFC file into several valid IFC files, each holding a subset of the products.
+* Every part holds the forward closure of its products and of the common entities
+* (placements, representations, styles, materials...), along with the relationships,
+* styled items and layer assignments attached to what it holds. Relationships listing
+* entities of several parts only list those within the part. Entities needed by several
+* parts are copied into each of them.
+* @param inputFile IFC file to split
+* @param parts map of {part name, ids of the products within the part}
+* @param common ids of the entities every part holds, such as the project and its spatial structure
+* @param outputPrefix each part is written to <outputPrefix>_<part name>.ifc
+* @param threads maximum number of parts processed in parallel
+* @return returns true if every part was written successfully
+*/
+bool splitFile(
+	const std::string                                   &inputFile,
+	const std::map<std::string, std::vector<unsigned>>  &parts,
+	const std::vector<unsigned>                         &common,
+	const std::string                                   &outputPrefix,
+	const unsigned                                      &threads);
@@ -0,0 +1,411 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "step.h"
+#include "progress.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+
+/**
+* Skip whitespace and comments
+* @param pos position to start from
+* @param end end of the buffer
+* @return returns the position of the next meaningful character
+*/
+static const char* skipBlank(const char *pos, const char *end)
+{
+	while (pos < end)
+	{
+		if (std::isspace((unsigned char)*pos))
+		{
+			++pos;
+		}
+		else if (*pos == '/' && pos + 1 < end && pos[1] == '*')
+		{
+			const char *close = "*/";
+			auto it = std::search(pos + 2, end, close, close + 2);
+			pos = it == end ? end : it + 2;
+		}
+		else
+		{
+			break;
+		}
+	}
+	return pos;
+}
+
+/**
+* Find the ';' terminating the statement at pos, ignoring any within strings or comments
+* @param pos position to start from
+* @param end end of the buffer
+* @return returns the position of the ';', or end if the statement is unterminated
+*/
+static const char* findTerminator(const char *pos, const char *end)
+{
+	bool inString = false;
+	while (pos < end)
+	{
+		if (*pos == '\'')
+		{
+			//an escaped quote ('') simply toggles twice
+			inString = !inString;
+		}
+		else if (!inString)
+		{
+			if (*pos == ';')
+				return pos;
+			if (*pos == '/' && pos + 1 < end && pos[1] == '*')
+			{
+				pos = skipBlank(pos, end);
+				continue;
+			}
+		}
+		++pos;
+	}
+	return end;
+}
+
+bool StepFile::open(const std::string &file)
+{
+	try
+	{
+		mapping = boost::interprocess::file_mapping(file.c_str(), boost::interprocess::read_only);
+		region = boost::interprocess::mapped_region(mapping, boost::interprocess::read_only);
+	}
+	catch (const boost::interprocess::interprocess_exception &e)
+	{
+		std::cerr << "Failed to map " << file << ": " << e.what() << std::endl;
+		return false;
+	}
+
+	//Records are read front to back, let the OS read ahead of the parser
+	region.advise(boost::interprocess::mapped_region::advice_sequential);
+
+	data = static_cast<const char*>(region.get_address());
+	size = region.get_size();
+	auto end = data + size;
+
+	//Find the DATA section, the header is made of statements like any other
+	dataBegin = nullptr;
+	auto pos = skipBlank(data, end);
+	while (pos < end)
+	{
+		auto terminator = findTerminator(pos, end);
+		auto last = terminator;
+		while (last > pos && std::isspace((unsigned char)last[-1])) --last;
+		if (last - pos == 4 && !std::strncmp(pos, "DATA", 4))
+		{
+			dataBegin = terminator + 1;
+			break;
+		}
+		pos = terminator < end ? skipBlank(terminator + 1, end) : end;
+	}
+
+	if (!dataBegin)
+	{
+		std::cerr << "Cannot find a DATA section in " << file << std::endl;
+		return false;
+	}
+
+	const char *endsec = "ENDSEC";
+	dataEnd = std::find_end(dataBegin, end, endsec, endsec + 6);
+	cursor = dataBegin;
+	return true;
+}
+
+bool StepFile::readAt(const size_t &offset, StepRecord &record)
+{
+	if (offset < size_t(dataBegin - data) || offset >= size_t(dataEnd - data))
+		return false;
+
+	cursor = data + offset;
+	return next(record);
+}
+
+std::vector<size_t> StepFile::partition(const size_t &parts) const
+{
+	std::vector<size_t> offsets = { size_t(dataBegin - data) };
+	auto length = size_t(dataEnd - dataBegin);
+	for (size_t i = 1; i < parts; ++i)
+	{
+		auto pos = std::max(dataBegin + length * i / parts, data + offsets.back());
+		//look for a line starting with #<id>=
+		while (pos < dataEnd)
+		{
+			pos = std::find(pos, dataEnd, '\n');
+			if (pos == dataEnd)
+				break;
+			auto id = ++pos;
+			if (id < dataEnd && *id == '#')
+			{
+				do { ++id; } while (id < dataEnd && std::isdigit((unsigned char)*id));
+				while (id < dataEnd && (*id == ' ' || *id == '\t')) ++id;
+				if (id < dataEnd && *id == '=')
+					break;
+			}
+		}
+		if (size_t(pos - data) > offsets.back())
+			offsets.push_back(pos - data);
+	}
+	if (offsets.back() != size_t(dataEnd - data))
+		offsets.push_back(dataEnd - data);
+	return offsets;
+}
+
+bool StepFile::next(StepRecord &record)
+{
+	cursor = skipBlank(cursor, dataEnd);
+	if (cursor >= dataEnd)
+		return false;
+
+	if (*cursor != '#')
+	{
+		std::cerr << "Unexpected content at byte " << position() << ", expected an entity instance" << std::endl;
+		cursor = dataEnd;
+		return false;
+	}
+
+	record.begin = cursor;
+	record.id = 0;
+	auto pos = cursor + 1;
+	while (pos < dataEnd && std::isdigit((unsigned char)*pos))
+		record.id = record.id * 10 + (*pos++ - '0');
+
+	pos = skipBlank(pos, dataEnd);
+	if (pos < dataEnd && *pos == '=') ++pos;
+	pos = skipBlank(pos, dataEnd);
+
+	record.typeBegin = pos;
+	while (pos < dataEnd && (std::isalnum((unsigned char)*pos) || *pos == '_')) ++pos;
+	record.typeEnd = pos;
+
+	auto terminator = findTerminator(pos, dataEnd);
+	record.end = terminator < dataEnd ? terminator + 1 : dataEnd;
+	cursor = record.end;
+	return true;
+}
+
+bool StepRecord::isType(const char *name) const
+{
+	auto pos = typeBegin;
+	for (; *name && pos < typeEnd; ++pos, ++name)
+	{
+		if (std::toupper((unsigned char)*pos) != *name)
+			return false;
+	}
+	return !*name && pos == typeEnd;
+}
+
+uint64_t canonicalHash(const char *begin, const char *end)
+{
+	//FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	bool inString = false;
+	for (auto pos = begin; pos < end; ++pos)
+	{
+		char c = *pos;
+		if (c == '\'')
+		{
+			inString = !inString;
+		}
+		else if (!inString)
+		{
+			if (std::isspace((unsigned char)c) || c == ';')
+				continue;
+			c = std::toupper((unsigned char)c);
+		}
+		hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+	}
+	return hash ? hash : 1;
+}
+
+void collectReferences(const StepRecord &record, std::vector<unsigned> &refs)
+{
+	collectReferences(record.typeEnd, record.end, refs);
+}
+
+void collectReferences(const char *begin, const char *end, std::vector<unsigned> &refs)
+{
+	bool inString = false;
+	for (auto pos = begin; pos < end; ++pos)
+	{
+		if (*pos == '\'')
+		{
+			inString = !inString;
+		}
+		else if (!inString && *pos == '#')
+		{
+			unsigned id = 0;
+			while (pos + 1 < end && std::isdigit((unsigned char)pos[1]))
+				id = id * 10 + (*++pos - '0');
+			refs.push_back(id);
+		}
+	}
+}
+
+void appendRenumbered(std::string &out, const StepRecord &record, const std::function<unsigned(const unsigned &)> &newId)
+{
+	out += '#';
+	out += std::to_string(newId(record.id));
+	out += '=';
+
+	bool inString = false;
+	for (auto pos = record.typeBegin; pos < record.end; ++pos)
+	{
+		if (*pos == '\'')
+		{
+			inString = !inString;
+		}
+		else if (!inString && *pos == '#')
+		{
+			unsigned id = 0;
+			auto digits = pos + 1;
+			while (digits < record.end && *digits >= '0' && *digits <= '9')
+				id = id * 10 + (*digits++ - '0');
+
+			//e.g. dangling references are left as they are
+			if (auto replacement = newId(id))
+			{
+				out += '#';
+				out += std::to_string(replacement);
+				pos = digits - 1;
+				continue;
+			}
+		}
+		out += *pos;
+	}
+	out += '\n';
+}
+
+void splitArguments(const StepRecord &record, std::vector<StepArgument> &args)
+{
+	args.clear();
+	auto pos = skipBlank(record.typeEnd, record.end);
+	if (pos >= record.end || *pos != '(')
+		return;
+
+	auto addArgument = [&](const char *begin, const char *end)
+	{
+		while (begin < end && std::isspace((unsigned char)*begin)) ++begin;
+		while (end > begin && std::isspace((unsigned char)end[-1])) --end;
+		args.push_back({ begin, end });
+	};
+
+	int depth = 0;
+	bool inString = false;
+	auto argBegin = pos + 1;
+	for (; pos < record.end; ++pos)
+	{
+		if (*pos == '\'')
+		{
+			inString = !inString;
+		}
+		else if (!inString)
+		{
+			if (*pos == '(')
+			{
+				++depth;
+			}
+			else if (*pos == ')')
+			{
+				if (!--depth)
+				{
+					//an empty argument list has no arguments at all
+					if (args.size() || skipBlank(argBegin, pos) < pos)
+						addArgument(argBegin, pos);
+					return;
+				}
+			}
+			else if (*pos == ',' && depth == 1)
+			{
+				addArgument(argBegin, pos);
+				argBegin = pos + 1;
+			}
+		}
+	}
+}
+
+bool decodeString(const StepArgument &arg, std::string &value)
+{
+	value.clear();
+	if (arg.second - arg.first < 2 || *arg.first != '\'' || arg.second[-1] != '\'')
+		return false;
+
+	for (auto pos = arg.first + 1; pos < arg.second - 1; ++pos)
+	{
+		if (*pos == '\\')
+			return false;
+		value += *pos;
+		if (*pos == '\'')
+			++pos;
+	}
+	return true;
+}
+
+unsigned referencedId(const StepArgument &arg)
+{
+	if (arg.first == arg.second || *arg.first != '#')
+		return 0;
+
+	unsigned id = 0;
+	for (auto pos = arg.first + 1; pos < arg.second && std::isdigit((unsigned char)*pos); ++pos)
+		id = id * 10 + (*pos - '0');
+	return id;
+}
+
+bool readGraph(StepFile &file, const std::string &fileName, const std::string &phase, StepGraph &graph,
+	const ReferenceCollector &collect)
+{
+	Progress progress(phase, fileName, file.fileSize());
+	StepRecord record;
+	while (file.next(record))
+	{
+		if (record.id >= graph.idToIndex.size())
+			graph.idToIndex.resize(std::max<size_t>(record.id + 1, graph.idToIndex.size() * 2), NOT_FOUND);
+		if (graph.idToIndex[record.id] != NOT_FOUND)
+		{
+			std::cerr << "Duplicate entity #" << record.id << " in " << fileName << std::endl;
+			return false;
+		}
+
+		unsigned index = graph.records.size();
+		graph.idToIndex[record.id] = index;
+		graph.refStart.push_back(graph.refs.size());
+		if (collect)
+			collect(index, record, graph.refs);
+		else
+			collectReferences(record, graph.refs);
+		graph.records.push_back(record);
+
+		if (!progress.update(graph.records.size(), file.position()))
+			return false;
+	}
+	graph.refStart.push_back(graph.refs.size());
+
+	for (auto &ref : graph.refs)
+	{
+		ref = graph.indexOf(ref);
+		if (ref == NOT_FOUND)
+			++graph.dangling;
+	}
+
+	progress.finish();
+	return true;
+}
@@ -0,0 +1,235 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* Lightweight, text level access to STEP physical files (ISO 10303-21).
+* Unlike IfcParse::IfcFile, nothing is parsed beyond the record boundaries,
+* so these can be used to stream through files of any size.
+*/
+
+#pragma once
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+//Index of a record that does not exist
+static const unsigned NOT_FOUND = std::numeric_limits<unsigned>::max();
+
+/**
+* A single entity instance within the DATA section, i.e. #<id>=<TYPE>(<arguments>);
+* The pointers refer to memory owned by the StepFile it was read from.
+*/
+struct StepRecord
+{
+	unsigned    id;
+	const char *begin;     //the leading '#'
+	const char *end;       //one past the terminating ';'
+	const char *typeBegin; //the type keyword
+	const char *typeEnd;
+
+	/**
+	* @return returns the type keyword of the record, as written in the file
+	*/
+	std::string type() const { return std::string(typeBegin, typeEnd); }
+
+	/**
+	* @return returns the text of the record, including the terminating ';'
+	*/
+	std::string text() const { return std::string(begin, end); }
+
+	/**
+	* @param name upper case name of the type, e.g. "IFCSTYLEDITEM"
+	* @return returns true if the record is of the given type, regardless of case
+	*/
+	bool isType(const char *name) const;
+};
+
+typedef std::pair<const char*, const char*> StepArgument;
+
+/**
+* A STEP physical file mapped into memory, read record by record
+*/
+class StepFile
+{
+public:
+	/**
+	* Map the given file and locate its DATA section
+	* @param file location of the file
+	* @return returns true upon success
+	*/
+	bool open(const std::string &file);
+
+	/**
+	* Read the next record of the DATA section
+	* @param record record to populate
+	* @return returns false once the end of the DATA section is reached
+	*/
+	bool next(StepRecord &record);
+
+	/**
+	* Read the record starting at the given offset, and continue reading from there
+	* @param offset offset of the record within the file, as given by offsetOf()
+	* @param record record to populate
+	* @return returns false if there is no record at the offset
+	*/
+	bool readAt(const size_t &offset, StepRecord &record);
+
+	/**
+	* @param record a record read from this file
+	* @return returns the offset of the record within the file
+	*/
+	size_t offsetOf(const StepRecord &record) const { return record.begin - data; }
+
+	/**
+	* Split the DATA section into consecutive ranges of roughly equal size, each
+	* starting at a record. Records are assumed to start on a new line.
+	* @param parts number of ranges to split into
+	* @return returns the offset each range starts at, followed by the end of the DATA section
+	*/
+	std::vector<size_t> partition(const size_t &parts) const;
+
+	/**
+	* Restart reading from the first record of the DATA section
+	*/
+	void rewind() { cursor = dataBegin; }
+
+	/**
+	* @return returns everything preceding the first record, up to and including "DATA;"
+	*/
+	std::string header() const { return std::string(data, dataBegin); }
+
+	/**
+	* @return returns everything following the last record, starting from "ENDSEC;"
+	*/
+	std::string trailer() const { return std::string(dataEnd, data + size); }
+
+	/**
+	* @return returns the number of bytes read so far
+	*/
+	size_t position() const { return cursor - data; }
+
+	/**
+	* @return returns the size of the file in bytes
+	*/
+	size_t fileSize() const { return size; }
+
+private:
+	boost::interprocess::file_mapping  mapping;
+	boost::interprocess::mapped_region region;
+	const char *data = nullptr;
+	size_t      size = 0;
+	const char *dataBegin = nullptr;
+	const char *dataEnd = nullptr;
+	const char *cursor = nullptr;
+};
+
+/**
+* Compute a hash of a record that is insensitive to whitespace and letter case
+* outside of string literals, so the same entity hashes equally whether it was
+* read from disk or serialised by IfcOpenShell
+* @param begin start of the record
+* @param end end of the record, a terminating ';' is ignored
+* @return returns a non-zero hash of the record
+*/
+uint64_t canonicalHash(const char *begin, const char *end);
+
+/**
+* Collect the entity ids referenced by a record, excluding its own id
+* @param record record to examine
+* @param refs vector to append the referenced ids to
+*/
+void collectReferences(const StepRecord &record, std::vector<unsigned> &refs);
+
+/**
+* Collect the entity ids referenced within part of a record, such as one of its arguments
+* @param begin start of the text to examine, outside of any string
+* @param end end of the text to examine
+* @param refs vector to append the referenced ids to
+*/
+void collectReferences(const char *begin, const char *end, std::vector<unsigned> &refs);
+
+/**
+* Append a record with its id and references replaced by new ones, followed by a new line
+* @param out text to append to
+* @param record record to append
+* @param newId gives the new id of an entity, 0 to leave the references to it as they are
+*/
+void appendRenumbered(std::string &out, const StepRecord &record, const std::function<unsigned(const unsigned &)> &newId);
+
+/**
+* Split the arguments of a record at its top level commas
+* @param record record to split
+* @param args vector to populate with the [begin, end) of each argument, with whitespace trimmed
+*/
+void splitArguments(const StepRecord &record, std::vector<StepArgument> &args);
+
+/**
+* Decode a string literal argument
+* @param arg the argument, e.g. 'It''s'
+* @param value the decoded value
+* @return returns false if the argument is not a string, or uses encodings (\X\, \S\ etc) that are not supported
+*/
+bool decodeString(const StepArgument &arg, std::string &value);
+
+/**
+* @param arg the argument, e.g. #12
+* @return returns the id referenced by the argument, 0 if it is not a reference
+*/
+unsigned referencedId(const StepArgument &arg);
+
+/**
+* The records of a file and the references between them, in a compressed row layout: the
+* references of the record at index i are refs[refStart[i]] up to refs[refStart[i + 1]].
+* References are given as record indices, NOT_FOUND for those to missing entities.
+*/
+struct StepGraph
+{
+	std::vector<StepRecord> records;
+	std::vector<unsigned>   refStart;
+	std::vector<unsigned>   refs;
+	std::vector<unsigned>   idToIndex;    //index of the record of each id, NOT_FOUND if none
+	size_t                  dangling = 0; //number of references to missing entities
+
+	/**
+	* @param id id of an entity
+	* @return returns the index of its record, NOT_FOUND if there is none
+	*/
+	unsigned indexOf(const unsigned &id) const { return id < idToIndex.size() ? idToIndex[id] : NOT_FOUND; }
+};
+
+/**
+* Appends the ids referenced by the record at the given index to refs
+*/
+typedef std::function<void(const unsigned &index, const StepRecord &record, std::vector<unsigned> &refs)> ReferenceCollector;
+
+/**
+* Read the remaining records of a file, along with the references between them
+* @param file file to read
+* @param fileName location of the file, to report progress and errors against
+* @param phase phase to report progress as
+* @param graph graph to populate
+* @param collect collects the references of each record, every reference of the record if not given
+* @return returns false if the file holds the same id twice, or if the run was cancelled
+*/
+bool readGraph(StepFile &file, const std::string &fileName, const std::string &phase, StepGraph &graph,
+	const ReferenceCollector &collect = ReferenceCollector());
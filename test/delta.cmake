@@ -0,0 +1,83 @@
+# Checks that a delta only holds what the override changes, that applying it gives the
+# very same file as a full rewrite, and that it is refused against any other base file.
+#
+# Run with: cmake -DIFCIMPROVER=<executable> -DDATA=<test/data> -DWORK=<scratch directory> -P delta.cmake
+
+function(run)
+	execute_process(COMMAND ${IFCIMPROVER} ${ARGN} RESULT_VARIABLE result OUTPUT_QUIET ERROR_VARIABLE error)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "IfcImprover ${ARGN} failed (${result}):\n${error}")
+	endif()
+endfunction()
+
+function(compare first second)
+	execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${first} ${second} RESULT_VARIABLE result)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "${first} and ${second} differ")
+	endif()
+endfunction()
+
+file(REMOVE_RECURSE ${WORK})
+file(MAKE_DIRECTORY ${WORK})
+
+# Only what the override changes makes up a delta, however the input file was formatted.
+# The fixture is written the way exporters do, e.g. 0.0 and 1.0E-5 rather than 0. and 1.E-05.
+run(--delta ${DATA}/model.ifc ${WORK}/raw.ifcd ${DATA}/override.csv)
+file(READ ${WORK}/raw.ifcd delta)
+string(REGEX MATCHALL "\n#[0-9]+=[A-Z0-9]+" entities "${delta}")
+list(LENGTH entities count)
+set(expected IFCRELASSOCIATESMATERIAL IFCSTYLEDITEM IFCPRESENTATIONSTYLEASSIGNMENT)
+foreach(entity ${entities})
+	string(REGEX REPLACE ".*=" "" type "${entity}")
+	list(FIND expected ${type} found)
+	if(found EQUAL -1)
+		set(count -1)
+	endif()
+endforeach()
+# The association of Brick, now also with Wall 1, the former styled item of Wall 1, and its new styled item and style assignment
+if(NOT count EQUAL 4 OR delta MATCHES "REMOVED")
+	message(FATAL_ERROR "The delta holds more than the override:\n${delta}")
+endif()
+
+# Unchanged records are copied from the base file as they are, so the base file has to be
+# formatted as IfcImprover writes models for a delta to give the same file as a full rewrite.
+# Rewrite the fixture with rules that match nothing.
+run(${DATA}/model.ifc ${WORK}/base.ifc ${DATA}/unchanged.csv)
+
+run(${WORK}/base.ifc ${WORK}/full.ifc ${DATA}/override.csv)
+run(--delta ${WORK}/base.ifc ${WORK}/model.ifcd ${DATA}/override.csv)
+run(apply ${WORK}/base.ifc ${WORK}/model.ifcd ${WORK}/applied.ifc)
+compare(${WORK}/full.ifc ${WORK}/applied.ifc)
+
+# The delta must actually hold the override, not the whole model. Points needing all
+# 17 digits must not be mistaken for modified ones either.
+file(READ ${WORK}/model.ifcd delta)
+if(NOT delta MATCHES "IFCSTYLEDITEM" OR delta MATCHES "IFCWALLSTANDARDCASE" OR delta MATCHES "IFCCARTESIANPOINT")
+	message(FATAL_ERROR "Unexpected delta:\n${delta}")
+endif()
+
+# Pipelined runs produce the same files
+run(--pipeline ${WORK}/base.ifc ${WORK}/full-pipelined.ifc ${DATA}/override.csv)
+compare(${WORK}/full.ifc ${WORK}/full-pipelined.ifc)
+run(--delta --pipeline ${WORK}/base.ifc ${WORK}/model-pipelined.ifcd ${DATA}/override.csv)
+compare(${WORK}/model.ifcd ${WORK}/model-pipelined.ifcd)
+
+# Within a memory limit, the changes are merged back through a delta as well
+run(--memory-limit 1G ${WORK}/base.ifc ${WORK}/full-budget.ifc ${DATA}/override.csv)
+compare(${WORK}/full.ifc ${WORK}/full-budget.ifc)
+
+# A delta computed against another file is refused, and leaves no output behind
+file(READ ${WORK}/base.ifc base)
+string(REPLACE "'Wall 2'" "'Wall 3'" other "${base}")
+if(other STREQUAL base)
+	message(FATAL_ERROR "Failed to alter the base file")
+endif()
+file(WRITE ${WORK}/other.ifc "${other}")
+execute_process(COMMAND ${IFCIMPROVER} apply ${WORK}/other.ifc ${WORK}/model.ifcd ${WORK}/wrong.ifc
+	RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+if(result EQUAL 0)
+	message(FATAL_ERROR "A delta was applied to the wrong base file")
+endif()
+if(EXISTS ${WORK}/wrong.ifc)
+	message(FATAL_ERROR "Applying a delta to the wrong base file left ${WORK}/wrong.ifc behind")
+endif()
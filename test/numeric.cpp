@@ -0,0 +1,157 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* Tests of RealFormat: exact values must read back as the very same double,
+* rounded values must be written with the expected digits.
+*/
+
+#include "../numeric.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+
+static int failures = 0;
+
+/**
+* @param format format to use
+* @param value value to format
+* @return returns the value as formatted
+*/
+static std::string format(const RealFormat &format, const double &value)
+{
+	std::string out;
+	format.append(out, value);
+	return out;
+}
+
+/**
+* Check that a value reads back exactly, and is written in STEP syntax
+* @param value value to check
+*/
+static void checkRoundTrip(const double &value)
+{
+	auto text = format(RealFormat(), value);
+	auto exponent = text.find('E');
+	bool valid = text.find('e') == std::string::npos
+		&& text.find('.') < exponent;
+	if (!valid || std::strtod(text.c_str(), nullptr) != value)
+	{
+		std::cerr << "Round trip of " << value << " failed: " << text << std::endl;
+		++failures;
+	}
+}
+
+/**
+* Check that a value is formatted as expected
+* @param quantum step to round to, 0 for exact values
+* @param value value to format
+* @param expected expected text
+*/
+static void checkFormat(const double &quantum, const double &value, const std::string &expected)
+{
+	auto text = format(RealFormat(quantum), value);
+	if (text != expected)
+	{
+		std::cerr << "Formatting " << value << " with a step of " << quantum << " gave " << text << ", expected " << expected << std::endl;
+		++failures;
+	}
+}
+
+int main()
+{
+	//Edge cases of the exact mode
+	const double values[] = {
+		0.0, -0.0, 1.0, -1.0, 0.1, 0.2, 0.30000000000000004, 1.0 / 3, 2.0 / 3, 123456.789, -2.5e-5, 1e-7,
+		1e15, 1e15 + 0.5, 999999999999999.9, 1e16, 9007199254740993.0, 1e300, -1e-300,
+		DBL_MAX, -DBL_MAX, DBL_MIN, DBL_EPSILON, 1 + DBL_EPSILON,
+		std::numeric_limits<double>::denorm_min(), 4.9406564584124654e-324, 2.2250738585072009e-308,
+		5e-324 * 12345, 0.1 + 0.7, 1.7976931348623157e308, 3.0000000000000004, 100.00000000000001
+	};
+	for (const auto &value : values)
+		checkRoundTrip(value);
+
+	//Arbitrary bit patterns, covering every exponent
+	uint64_t state = 88172645463325252ULL;
+	for (int i = 0; i < 200000; ++i)
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		double value;
+		std::memcpy(&value, &state, sizeof(value));
+		if (std::isfinite(value))
+			checkRoundTrip(value);
+	}
+
+	//Coordinates as found in models
+	for (int i = -100000; i <= 100000; ++i)
+		checkRoundTrip(i * 0.001);
+
+	//Shortest representation, in STEP syntax
+	checkFormat(0, 0.0, "0.");
+	checkFormat(0, -0.0, "0.");
+	checkFormat(0, 1.0, "1.");
+	checkFormat(0, -3.0, "-3.");
+	checkFormat(0, 0.1, "0.1");
+	checkFormat(0, -0.25, "-0.25");
+	checkFormat(0, 1.5e-5, "1.5E-05");
+	checkFormat(0, 1e15, "1.E+15");
+	checkFormat(0, 0.30000000000000004, "0.30000000000000004");
+
+	//Rounded to a power of ten
+	checkFormat(0.0001, 0.123456, "0.1235");
+	checkFormat(0.0001, 1.00004, "1.");
+	checkFormat(0.0001, -0.00004, "0.");
+	checkFormat(0.0001, -12.5, "-12.5");
+	checkFormat(0.01, 0.1 + 0.2, "0.3");
+	checkFormat(10, 1234.5, "1230.");
+
+	//Steps that are not a power of ten are snapped down to one, e.g. 0.0001m in feet
+	checkFormat(0.0001 / 0.3048, 0.1, "0.1");
+	checkFormat(0.0001 / 0.3048, 0.123456, "0.1235");
+	checkFormat(0.0025, 0.123456, "0.123");
+
+	//The finest steps need the most digits, these must still read back close to the value
+	for (const auto &value : { -123456789012345.6, 987654321098765.4, -0.123456789012345678 })
+	{
+		auto text = format(RealFormat(1e-20), value);
+		if (std::abs(std::strtod(text.c_str(), nullptr) - value) > std::abs(value) * 1e-15)
+		{
+			std::cerr << "Formatting " << value << " with a step of 1e-20 gave " << text << std::endl;
+			++failures;
+		}
+	}
+
+	std::string entity;
+	RealFormat().appendEntity(entity, 5, "IFCCARTESIANPOINT", { 0.1, 2, -3.5 });
+	if (entity != "#5=IFCCARTESIANPOINT((0.1,2.,-3.5))")
+	{
+		std::cerr << "Unexpected entity " << entity << std::endl;
+		++failures;
+	}
+
+	if (failures)
+		std::cerr << failures << " checks failed" << std::endl;
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
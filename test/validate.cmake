@@ -0,0 +1,34 @@
+# Checks that validate accepts the fixture, and rejects copies of it broken in each of the
+# ways it looks for: a dangling reference, an unset required attribute and an abstract entity.
+#
+# Run with: cmake -DIFCIMPROVER=<executable> -DDATA=<test/data> -DWORK=<scratch directory> -P validate.cmake
+
+file(REMOVE_RECURSE ${WORK})
+file(MAKE_DIRECTORY ${WORK})
+
+execute_process(COMMAND ${IFCIMPROVER} validate ${DATA}/model.ifc RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE error)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "validate rejected ${DATA}/model.ifc (${result}):\n${output}${error}")
+endif()
+
+file(READ ${DATA}/model.ifc model)
+
+# Write a copy of the fixture with <from> replaced by <to>, and check that validate rejects it for the expected issue
+function(reject name from to issue)
+	string(REPLACE "${from}" "${to}" broken "${model}")
+	if(broken STREQUAL model)
+		message(FATAL_ERROR "Failed to break the fixture for ${name}")
+	endif()
+	file(WRITE ${WORK}/${name}.ifc "${broken}")
+	execute_process(COMMAND ${IFCIMPROVER} validate ${WORK}/${name}.ifc RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_QUIET)
+	if(result EQUAL 0)
+		message(FATAL_ERROR "validate accepted ${WORK}/${name}.ifc")
+	endif()
+	if(NOT output MATCHES "${issue}")
+		message(FATAL_ERROR "validate rejected ${WORK}/${name}.ifc without reporting \"${issue}\":\n${output}")
+	endif()
+endfunction()
+
+reject(dangling "(#26,#30),#15)" "(#26,#30,#999),#15)" "Reference to a missing entity: 1")
+reject(required "#38=IFCMATERIAL('Steel');" "#38=IFCMATERIAL($);" "Required attribute not set: 1")
+reject(abstract "#51=" "#99=IFCSWEPTAREASOLID(#19,#11);\n#51=" "Abstract entity type instantiated: 1")
@@ -0,0 +1,346 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "validator.h"
+#include "progress.h"
+#include "step.h"
+
+#include <ifcparse/IfcParse.h>
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+//Number of examples listed per kind of issue
+static const size_t MAX_EXAMPLES = 10;
+
+//Abstract entities of the schema IfcParse was built for (USE_IFC4 selects IFC4, IFC2x3 otherwise),
+//taken from the ABSTRACT SUPERTYPE declarations of its EXPRESS definition. IfcParse does not expose abstractness.
+static const std::set<std::string> ABSTRACT_TYPES = {
+	//Kernel and relationships
+	"IFCROOT", "IFCOBJECTDEFINITION", "IFCOBJECT", "IFCPRODUCT", "IFCCONTROL", "IFCPROCESS", "IFCRESOURCE",
+	"IFCCONSTRUCTIONRESOURCE", "IFCRELATIONSHIP", "IFCRELCONNECTS", "IFCRELDECOMPOSES", "IFCRELDEFINES", "IFCRELASSIGNS",
+	"IFCPROPERTYDEFINITION", "IFCPROPERTYSETDEFINITION", "IFCPROPERTY", "IFCSIMPLEPROPERTY",
+	"IFCPHYSICALQUANTITY", "IFCPHYSICALSIMPLEQUANTITY", "IFCOBJECTPLACEMENT", "IFCPORT",
+	//Elements and their types
+	"IFCELEMENT", "IFCBUILDINGELEMENT", "IFCELEMENTCOMPONENT", "IFCFEATUREELEMENT", "IFCFEATUREELEMENTADDITION",
+	"IFCFEATUREELEMENTSUBTRACTION", "IFCSPATIALSTRUCTUREELEMENT", "IFCSPATIALSTRUCTUREELEMENTTYPE",
+	"IFCELEMENTTYPE", "IFCBUILDINGELEMENTTYPE", "IFCELEMENTCOMPONENTTYPE",
+	"IFCDISTRIBUTIONFLOWELEMENTTYPE", "IFCDISTRIBUTIONCONTROLELEMENTTYPE", "IFCENERGYCONVERSIONDEVICETYPE",
+	"IFCFLOWCONTROLLERTYPE", "IFCFLOWFITTINGTYPE", "IFCFLOWMOVINGDEVICETYPE", "IFCFLOWSEGMENTTYPE",
+	"IFCFLOWSTORAGEDEVICETYPE", "IFCFLOWTERMINALTYPE", "IFCFLOWTREATMENTDEVICETYPE",
+	//Structural analysis
+	"IFCSTRUCTURALITEM", "IFCSTRUCTURALMEMBER", "IFCSTRUCTURALCONNECTION", "IFCSTRUCTURALACTIVITY",
+	"IFCSTRUCTURALACTION", "IFCSTRUCTURALREACTION", "IFCSTRUCTURALLOAD", "IFCSTRUCTURALLOADSTATIC",
+	"IFCBOUNDARYCONDITION", "IFCSTRUCTURALCONNECTIONCONDITION",
+	//Geometry and topology
+	"IFCREPRESENTATIONITEM", "IFCGEOMETRICREPRESENTATIONITEM", "IFCTOPOLOGICALREPRESENTATIONITEM",
+	"IFCPOINT", "IFCCURVE", "IFCBOUNDEDCURVE", "IFCCONIC", "IFCBSPLINECURVE", "IFCSURFACE", "IFCBOUNDEDSURFACE",
+	"IFCELEMENTARYSURFACE", "IFCSWEPTSURFACE", "IFCSOLIDMODEL", "IFCSWEPTAREASOLID", "IFCMANIFOLDSOLIDBREP",
+	"IFCCSGPRIMITIVE3D", "IFCPLACEMENT", "IFCCARTESIANTRANSFORMATIONOPERATOR", "IFCCONNECTIONGEOMETRY",
+	"IFCSHAPEMODEL", "IFCSTYLEMODEL", "IFCPARAMETERIZEDPROFILEDEF",
+	//Presentation
+	"IFCLIGHTSOURCE", "IFCPRESENTATIONSTYLE", "IFCCOLOURSPECIFICATION", "IFCSURFACETEXTURE", "IFCTEXTURECOORDINATE",
+	"IFCPREDEFINEDITEM", "IFCPREDEFINEDCOLOUR", "IFCPREDEFINEDCURVEFONT", "IFCPREDEFINEDTEXTFONT",
+	//Resources
+	"IFCNAMEDUNIT", "IFCADDRESS", "IFCCONSTRAINT", "IFCEXTERNALREFERENCE", "IFCTIMESERIES",
+#ifdef USE_IFC4
+	"IFCCONTEXT", "IFCRELASSOCIATES", "IFCPROPERTYABSTRACTION", "IFCPREDEFINEDPROPERTYSET", "IFCQUANTITYSET",
+	"IFCPROPERTYTEMPLATEDEFINITION", "IFCPROPERTYTEMPLATE", "IFCPREDEFINEDPROPERTIES", "IFCEXTENDEDPROPERTIES",
+	"IFCSPATIALELEMENT", "IFCSPATIALELEMENTTYPE", "IFCTYPEPROCESS", "IFCTYPERESOURCE", "IFCCONSTRUCTIONRESOURCETYPE",
+	"IFCSTRUCTURALLOADORRESULT", "IFCBSPLINESURFACE", "IFCTESSELLATEDITEM", "IFCTESSELLATEDFACESET",
+	"IFCPRESENTATIONITEM", "IFCREPRESENTATION", "IFCPRODUCTREPRESENTATION", "IFCCOORDINATEOPERATION",
+	"IFCMATERIALDEFINITION", "IFCMATERIALUSAGEDEFINITION", "IFCSCHEDULINGTIME", "IFCRESOURCELEVELRELATIONSHIP",
+	"IFCEXTERNALINFORMATION"
+#else
+	"IFCANNOTATIONOCCURRENCE", "IFCBUILDINGELEMENTCOMPONENT", "IFCPREDEFINEDSYMBOL", "IFCMATERIALPROPERTIES",
+	"IFCPROFILEPROPERTIES", "IFCAPPLIEDVALUE"
+#endif
+};
+
+enum IssueType
+{
+	UNKNOWN_TYPE,
+	ABSTRACT_TYPE,
+	ATTRIBUTE_COUNT,
+	REQUIRED_ATTRIBUTE,
+	MISSING_REFERENCE,
+	DUPLICATE_ID,
+	UNSTYLED_ITEM,
+	ISSUE_TYPE_COUNT
+};
+
+static const char* const ISSUE_NAMES[] = {
+	"Unknown entity type",
+	"Abstract entity type instantiated",
+	"Wrong number of attributes",
+	"Required attribute not set",
+	"Reference to a missing entity",
+	"Duplicate entity id",
+	"IfcStyledItem without an Item"
+};
+
+/**
+* What the schema says about an entity type
+*/
+struct TypeInfo
+{
+	bool              known = false;
+	bool              abstract = false;
+	bool              styledItem = false;
+	size_t            attributes = 0;
+	std::vector<bool> optional;
+};
+
+/**
+* Issues found within a range of entities
+*/
+struct Report
+{
+	size_t                   counts[ISSUE_TYPE_COUNT] = {};
+	std::vector<std::string> examples[ISSUE_TYPE_COUNT];
+	size_t                   checked = 0;
+
+	void add(const IssueType &type, const StepRecord &record, const std::string &detail)
+	{
+		if (counts[type]++ < MAX_EXAMPLES)
+			examples[type].push_back("#" + std::to_string(record.id) + "=" + record.type() + ": " + detail);
+	}
+
+	void merge(const Report &other)
+	{
+		checked += other.checked;
+		for (int i = 0; i < ISSUE_TYPE_COUNT; ++i)
+		{
+			counts[i] += other.counts[i];
+			for (const auto &example : other.examples[i])
+			{
+				if (examples[i].size() < MAX_EXAMPLES)
+					examples[i].push_back(example);
+			}
+		}
+	}
+};
+
+/**
+* Look up a type within the schema
+* @param name the type keyword as written in the file
+* @return returns what is known about the type
+*/
+static TypeInfo lookUpType(std::string name)
+{
+	std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+
+	TypeInfo info;
+	info.abstract = ABSTRACT_TYPES.count(name) > 0;
+	info.styledItem = name == "IFCSTYLEDITEM";
+	try
+	{
+		auto type = IfcSchema::Type::FromString(name);
+		info.known = true;
+		info.attributes = IfcSchema::Type::GetAttributeCount(type);
+		for (size_t i = 0; i < info.attributes; ++i)
+			info.optional.push_back(IfcSchema::Type::GetAttributeOptional(type, i));
+	}
+	catch (const std::exception &)
+	{
+		info.known = false;
+	}
+	return info;
+}
+
+/**
+* Run a function over each range of the file on its own thread
+* @param file file to process
+* @param ranges ranges of the file, as given by StepFile::partition()
+* @param func function called with the index of the range and a StepFile positioned at its start
+*/
+template <typename Func>
+static void forEachRange(const std::string &file, const std::vector<size_t> &ranges, Func func)
+{
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i + 1 < ranges.size(); ++i)
+	{
+		workers.push_back(std::thread([&, i]()
+		{
+			//each thread maps the file for itself, reading moves the cursor of a StepFile
+			StepFile range;
+			if (range.open(file))
+				func(i, range);
+		}));
+	}
+	for (auto &worker : workers)
+		worker.join();
+}
+
+bool validateFile(const std::string &file, const unsigned &threads)
+{
+	StepFile stepFile;
+	if (!stepFile.open(file))
+		return false;
+	auto ranges = stepFile.partition(std::max(1u, threads));
+	auto rangeCount = ranges.size() ? ranges.size() - 1 : 0;
+
+	//Progress is accounted for in batches, to keep the threads off each other's cache lines
+	static const size_t PROGRESS_BATCH = 4096;
+
+	//First pass: which ids exist, and which types are used
+	std::vector<std::vector<unsigned>> ids(rangeCount);
+	std::vector<std::set<std::string>> types(rangeCount);
+	Progress indexProgress("index", file, stepFile.fileSize());
+	forEachRange(file, ranges, [&](const size_t &i, StepFile &range)
+	{
+		StepRecord record;
+		if (!range.readAt(ranges[i], record))
+			return;
+		auto reported = ranges[i];
+		do
+		{
+			ids[i].push_back(record.id);
+			types[i].insert(record.type());
+			if (ids[i].size() % PROGRESS_BATCH == 0)
+			{
+				if (!indexProgress.add(PROGRESS_BATCH, range.position() - reported))
+					return;
+				reported = range.position();
+			}
+		} while (range.next(record) && range.offsetOf(record) < ranges[i + 1]);
+		indexProgress.add(ids[i].size() % PROGRESS_BATCH, ranges[i + 1] - reported);
+	});
+	if (cancelled())
+		return false;
+	indexProgress.finish();
+
+	unsigned maxId = 0;
+	for (const auto &rangeIds : ids)
+	{
+		for (const auto &id : rangeIds)
+			maxId = std::max(maxId, id);
+	}
+
+	//number of times each id is defined
+	std::vector<uint8_t> defined(size_t(maxId) + 1, 0);
+	for (auto &rangeIds : ids)
+	{
+		for (const auto &id : rangeIds)
+		{
+			if (defined[id] < 255)
+				++defined[id];
+		}
+		std::vector<unsigned>().swap(rangeIds);
+	}
+
+	//The schema is only queried from this thread
+	std::map<std::string, TypeInfo> typeInfo;
+	for (const auto &rangeTypes : types)
+	{
+		for (const auto &type : rangeTypes)
+		{
+			if (!typeInfo.count(type))
+				typeInfo[type] = lookUpType(type);
+		}
+	}
+
+	//Second pass: check every entity
+	std::vector<Report> reports(rangeCount);
+	Progress checkProgress("validate", file, stepFile.fileSize());
+	forEachRange(file, ranges, [&](const size_t &i, StepFile &range)
+	{
+		auto &report = reports[i];
+		std::vector<StepArgument> args;
+		std::vector<unsigned> refs;
+		StepRecord record;
+		if (!range.readAt(ranges[i], record))
+			return;
+		auto reported = ranges[i];
+		do
+		{
+			if (++report.checked % PROGRESS_BATCH == 0)
+			{
+				if (!checkProgress.add(PROGRESS_BATCH, range.position() - reported))
+					return;
+				reported = range.position();
+			}
+
+			if (defined[record.id] > 1)
+				report.add(DUPLICATE_ID, record, "defined " + std::to_string(defined[record.id]) + " times");
+
+			refs.clear();
+			collectReferences(record, refs);
+			for (const auto &ref : refs)
+			{
+				if (ref > maxId || !defined[ref])
+					report.add(MISSING_REFERENCE, record, "#" + std::to_string(ref) + " does not exist");
+			}
+
+			const auto &info = typeInfo.at(record.type());
+			if (!info.known)
+			{
+				report.add(UNKNOWN_TYPE, record, "not part of the schema");
+				continue;
+			}
+			if (info.abstract)
+				report.add(ABSTRACT_TYPE, record, "abstract types cannot be instantiated");
+
+			splitArguments(record, args);
+			if (args.size() != info.attributes)
+			{
+				report.add(ATTRIBUTE_COUNT, record, std::to_string(args.size()) + " attributes, expected " + std::to_string(info.attributes));
+				continue;
+			}
+
+			for (size_t arg = 0; arg < args.size(); ++arg)
+			{
+				bool isNull = args[arg].second - args[arg].first == 1 && *args[arg].first == '$';
+				if (isNull && !info.optional[arg])
+					report.add(REQUIRED_ATTRIBUTE, record, "attribute " + std::to_string(arg + 1) + " is required");
+				if (isNull && arg == 0 && info.styledItem)
+					report.add(UNSTYLED_ITEM, record, "styles nothing");
+			}
+		} while (range.next(record) && range.offsetOf(record) < ranges[i + 1]);
+		checkProgress.add(report.checked % PROGRESS_BATCH, ranges[i + 1] - reported);
+	});
+	if (cancelled())
+		return false;
+	checkProgress.finish();
+
+	Report total;
+	for (const auto &report : reports)
+		total.merge(report);
+
+	size_t issues = 0;
+	for (int i = 0; i < ISSUE_TYPE_COUNT; ++i)
+		issues += total.counts[i];
+
+	std::cout << file << ": " << total.checked << " entities checked, " << issues << " issues found" << std::endl;
+	for (int i = 0; i < ISSUE_TYPE_COUNT; ++i)
+	{
+		if (!total.counts[i])
+			continue;
+		std::cout << "\t" << ISSUE_NAMES[i] << ": " << total.counts[i] << std::endl;
+		for (const auto &example : total.examples[i])
+			std::cout << "\t\t" << example << std::endl;
+		if (total.counts[i] > total.examples[i].size())
+			std::cout << "\t\t..." << std::endl;
+	}
+
+	return !issues;
+}
@@ -0,0 +1,31 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+
+/**
+* Check the referential integrity of an IFC file: every reference resolves to an
+* entity, every entity is of a known, instantiable type with the right number of
+* attributes, required attributes are set, and styled items style something.
+* The file is split into ranges of entities checked in parallel.
+* @param file IFC file to check
+* @param threads number of threads to use
+* @return returns true if no issues were found
+*/
+bool validateFile(const std::string &file, const unsigned &threads);
@@ -0,0 +1,316 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "workingset.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "step.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <limits>
+#include <unordered_set>
+#include <vector>
+
+typedef std::map<std::string, std::map<std::string, std::string>> Rules;
+
+static const uint64_t NO_OFFSET = std::numeric_limits<uint64_t>::max();
+
+//Rough ratio of the memory IfcParse::IfcFile needs to hold a model, against the size of the file
+static const size_t PARSED_SIZE_FACTOR = 10;
+
+enum Inclusion : uint8_t
+{
+	EXCLUDED,
+	FULL,        //written as is, along with everything it references
+	SHALLOW,     //written as is, what it references is written as placeholders
+	PLACEHOLDER  //written with its type only
+};
+
+/**
+* Check whether an IfcPropertySingleValue record could match any of the rules.
+* Only plain string values can be compared reliably at this level, anything else is assumed to match.
+* @param record the IfcPropertySingleValue
+* @param rules rules to match against
+* @param args scratch space for the arguments of the record
+* @return returns false if the property cannot match any rule
+*/
+static bool mayMatch(const StepRecord &record, const Rules &rules, std::vector<StepArgument> &args)
+{
+	splitArguments(record, args);
+	if (args.size() < 3)
+		return false;
+
+	std::string name, value;
+	auto ruleIt = rules.end();
+	if (decodeString(args[0], name))
+	{
+		ruleIt = rules.find(name);
+		if (ruleIt == rules.end())
+			return false;
+	}
+
+	//The nominal value is a typed value, e.g. IFCLABEL('AB')
+	auto open = std::find(args[2].first, args[2].second, '(');
+	if (open == args[2].second)
+		return false;
+	StepArgument inner = { open + 1, args[2].second - 1 };
+	while (inner.first < inner.second && std::isspace((unsigned char)*inner.first)) ++inner.first;
+	while (inner.second > inner.first && std::isspace((unsigned char)inner.second[-1])) --inner.second;
+	if (!decodeString(inner, value))
+		return true;
+
+	if (ruleIt != rules.end())
+		return ruleIt->second.count(value) > 0;
+
+	for (const auto &rule : rules)
+	{
+		if (rule.second.count(value))
+			return true;
+	}
+	return false;
+}
+
+bool extractWorkingSet(
+	const std::string &inputFile,
+	const Rules       &rules,
+	const std::string &subsetFile,
+	const size_t      &memoryLimit,
+	DeltaBase         &base)
+{
+	StepFile file;
+	if (!file.open(inputFile))
+		return false;
+
+	std::vector<uint64_t> offsets;
+	std::vector<unsigned> seeds, shallow, selected;
+	std::vector<std::pair<unsigned, unsigned>> styledItems;   //{item, styled item}
+	std::vector<std::pair<unsigned, unsigned>> propertyRels;  //{property set, IfcRelDefinesByProperties}
+	std::vector<StepArgument> args;
+	std::vector<unsigned> refs;
+	unsigned maxId = 0;
+
+	//First pass: index the records and find the properties that may match, along with
+	//everything that refers to entities from the other direction
+	Progress indexProgress("index", inputFile, file.fileSize());
+	StepRecord record;
+	while (file.next(record))
+	{
+		if (record.id >= offsets.size())
+			offsets.resize(std::max<size_t>(record.id + 1, offsets.size() * 2), NO_OFFSET);
+		offsets[record.id] = file.offsetOf(record);
+		maxId = std::max(maxId, record.id);
+		base.fingerprint = updateFingerprint(base.fingerprint, canonicalHash(record.begin, record.end));
+		++base.records;
+
+		if (record.isType("IFCPROPERTYSINGLEVALUE"))
+		{
+			if (mayMatch(record, rules, args))
+				selected.push_back(record.id);
+		}
+		else if (record.isType("IFCSTYLEDITEM"))
+		{
+			splitArguments(record, args);
+			if (args.size() && referencedId(args[0]))
+				styledItems.push_back({ referencedId(args[0]), record.id });
+		}
+		else if (record.isType("IFCRELDEFINESBYPROPERTIES"))
+		{
+			splitArguments(record, args);
+			if (args.size() > 5 && referencedId(args[5]))
+				propertyRels.push_back({ referencedId(args[5]), record.id });
+		}
+		else if (record.isType("IFCMATERIAL") || record.isType("IFCSURFACESTYLE"))
+		{
+			seeds.push_back(record.id);
+		}
+		else if (record.isType("IFCRELASSOCIATESMATERIAL"))
+		{
+			shallow.push_back(record.id);
+		}
+
+		if (!indexProgress.update(base.records, file.position()))
+			return false;
+	}
+	indexProgress.finish();
+
+	//offsets, inclusion and the delta hashes of the working set are all indexed by id
+	size_t indexSize = offsets.size() * (2 * sizeof(uint64_t) + sizeof(uint8_t))
+		+ (styledItems.size() + propertyRels.size()) * sizeof(std::pair<unsigned, unsigned>);
+	if (memoryLimit && indexSize > memoryLimit)
+	{
+		std::cerr << "Not starting: the index of " << inputFile << " alone needs " << (indexSize >> 20) << " MB, more than the memory limit" << std::endl;
+		return false;
+	}
+
+	std::vector<uint8_t> inclusion(offsets.size(), EXCLUDED);
+	std::vector<unsigned> stack;
+	size_t missing = 0;
+
+	auto includeFull = [&](const unsigned &id)
+	{
+		if (id >= offsets.size() || offsets[id] == NO_OFFSET)
+		{
+			++missing;
+		}
+		else if (inclusion[id] != FULL)
+		{
+			inclusion[id] = FULL;
+			stack.push_back(id);
+		}
+	};
+
+	auto includeClosure = [&]()
+	{
+		while (stack.size())
+		{
+			auto id = stack.back();
+			stack.pop_back();
+			file.readAt(offsets[id], record);
+			refs.clear();
+			collectReferences(record, refs);
+			for (const auto &ref : refs)
+				includeFull(ref);
+		}
+	};
+
+	//Second pass: property sets (or anything else) referring to the selected properties
+	std::vector<bool> isSelected(offsets.size(), false);
+	for (const auto &id : selected)
+		isSelected[id] = true;
+
+	std::unordered_set<unsigned> propertySets;
+	Progress propertyProgress("property-sets", inputFile, file.fileSize());
+	size_t records = 0;
+	file.rewind();
+	while (selected.size() && file.next(record))
+	{
+		refs.clear();
+		collectReferences(record, refs);
+		for (const auto &ref : refs)
+		{
+			if (ref < isSelected.size() && isSelected[ref])
+			{
+				propertySets.insert(record.id);
+				seeds.push_back(record.id);
+				break;
+			}
+		}
+		if (!propertyProgress.update(++records, file.position()))
+			return false;
+	}
+	propertyProgress.finish();
+
+	for (const auto &rel : propertyRels)
+	{
+		if (propertySets.count(rel.first))
+			seeds.push_back(rel.second);
+	}
+
+	seeds.insert(seeds.end(), selected.begin(), selected.end());
+	for (const auto &id : seeds)
+		includeFull(id);
+	includeClosure();
+
+	for (const auto &styled : styledItems)
+	{
+		if (styled.first < inclusion.size() && inclusion[styled.first] == FULL)
+			includeFull(styled.second);
+	}
+	includeClosure();
+
+	for (const auto &id : shallow)
+	{
+		if (inclusion[id] == FULL)
+			continue;
+		inclusion[id] = SHALLOW;
+		file.readAt(offsets[id], record);
+		refs.clear();
+		collectReferences(record, refs);
+		for (const auto &ref : refs)
+		{
+			if (ref < offsets.size() && offsets[ref] != NO_OFFSET && inclusion[ref] == EXCLUDED)
+				inclusion[ref] = PLACEHOLDER;
+		}
+	}
+
+	//New entities are numbered after the largest id in the file, keep it in the working set
+	if (maxId && inclusion[maxId] == EXCLUDED)
+		inclusion[maxId] = PLACEHOLDER;
+
+	if (missing)
+		std::cerr << "Warning: " << missing << " references to missing entities in " << inputFile << std::endl;
+
+	size_t workingSetSize = 0, workingSetEntities = 0;
+	for (unsigned id = 0; id < inclusion.size(); ++id)
+	{
+		if (inclusion[id] == FULL || inclusion[id] == SHALLOW)
+		{
+			file.readAt(offsets[id], record);
+			workingSetSize += record.end - record.begin;
+		}
+		if (inclusion[id] != EXCLUDED)
+			++workingSetEntities;
+	}
+
+	auto estimate = indexSize + workingSetSize * PARSED_SIZE_FACTOR;
+	std::cout << "Working set: " << workingSetEntities << " of " << base.records << " entities, estimated to need "
+		<< (estimate >> 20) << " MB" << std::endl;
+	if (memoryLimit && estimate > memoryLimit)
+	{
+		std::cerr << "Not starting: the working set is estimated to need " << (estimate >> 20) << " MB, more than the memory limit of "
+			<< (memoryLimit >> 20) << " MB. The estimate is made up front, nothing is loaded in its place." << std::endl;
+		return false;
+	}
+
+	//Write the working set, in id order
+	ShardWriter writer(subsetFile);
+	writer.append(file.header() + "\n");
+	std::string text;
+	for (unsigned id = 0; id < inclusion.size(); ++id)
+	{
+		if (inclusion[id] == EXCLUDED)
+			continue;
+
+		file.readAt(offsets[id], record);
+		if (inclusion[id] == PLACEHOLDER && record.typeBegin != record.typeEnd)
+		{
+			splitArguments(record, args);
+			text = "#" + std::to_string(id) + "=" + record.type() + "(";
+			for (size_t i = 0; i < args.size(); ++i)
+				text += i ? ",$" : "$";
+			text += ");";
+		}
+		else
+		{
+			text = record.text();
+		}
+
+		writer.append(text);
+		writer.append("\n", 1);
+	}
+	writer.append(file.trailer());
+
+	if (!writer.finish())
+	{
+		std::cerr << "Failed to write " << subsetFile << std::endl;
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,53 @@
+/**
+*  Copyright (C) 2016 3D Repo Ltd
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU Affero General Public License as
+*  published by the Free Software Foundation, either version 3 of the
+*  License, or (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU Affero General Public License for more details.
+*
+*  You should have received a copy of the GNU Affero General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* Memory budget mode: instead of loading the whole input through IfcParse::IfcFile,
+* only the entities a material override can touch are extracted into a small,
+* self contained IFC file. That working set is loaded and updated as usual, and
+* the changes are merged back by streaming the input file through them as a delta.
+* The input file itself stays on disk, memory mapped, throughout.
+*/
+
+#pragma once
+
+#include "delta.h"
+
+#include <map>
+#include <string>
+
+/**
+* Extract the entities a material override can touch into a small, self contained IFC file.
+* The working set is the forward closure of the matching properties, the property sets
+* and relationships referring to them, the materials and surface styles, and the styled
+* items of any representation item within. Entities only referred to by material
+* associations are written as placeholders holding nothing but their type.
+* @param inputFile input IFC file
+* @param rules a map of {Metadata Field name , {Metadata Value, Material Name}} covering every variant to apply
+* @param subsetFile location to write the working set to
+* @param memoryLimit number of bytes the run is estimated up front not to exceed, 0 for no limit.
+* This is not enforced later on, the run is refused if the estimate exceeds it.
+* @param base populated with the record count and fingerprint of the input file. The working set shares
+* the ids of the input file, so a delta of the working set is a delta of the input file.
+* @return returns true upon success
+*/
+bool extractWorkingSet(
+	const std::string                                                &inputFile,
+	const std::map<std::string, std::map<std::string, std::string>> &rules,
+	const std::string                                                &subsetFile,
+	const size_t                                                     &memoryLimit,
+	DeltaBase                                                        &base);